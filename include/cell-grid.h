@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "radix-sort.h"
+#include "task-pool.h"
+
+// Compact cell -> particles lookup built with a counting sort, the CPU
+// counterpart of CreateHashBuffer.cs/PrefixSum.cs/CreateEntriesBuffer.cs.
+// Particles of cell `key` are Entries()[CellBegin(key)..CellEnd(key)).
+//
+// Table slots carry the epoch of the Build() that wrote them and older slots
+// count as empty. When the table is much larger than the particle count a
+// build touches only the occupied cells and wipes the table once every 255
+// calls; otherwise it stamps and scans the whole table as before.
+class CellGrid {
+public:
+  CellGrid() = default;
+
+  // With more than one thread the order of particles inside a cell depends on
+  // scheduling, as it does on the GPU.
+  void Build(const std::vector<uint32_t> &keys, uint32_t tableSize,
+             TaskPool &pool);
+  // Incremental Build() for keys that mostly kept their value since the last
+  // build: particles whose key changed are sorted on their own and merged
+  // into the previous order. More than maxChanged of them, a different
+  // particle count or table size fall back to Build(). Returns true when the
+  // grid was updated incrementally.
+  bool Update(const std::vector<uint32_t> &keys, uint32_t tableSize,
+              float maxChanged, TaskPool &pool);
+
+  uint32_t CellBegin(uint32_t key) const {
+    return Occupied(key) ? m_cellStart[key] : 0;
+  }
+  uint32_t CellEnd(uint32_t key) const {
+    return Occupied(key) ? m_cellStart[key] + (m_cells[key] & COUNT_MASK) : 0;
+  }
+  const std::vector<uint32_t> &Entries() const { return m_entries; }
+
+private:
+  static constexpr uint32_t EPOCH_SHIFT = 24;
+  static constexpr uint32_t COUNT_MASK = (1u << EPOCH_SHIFT) - 1;
+
+  bool Occupied(uint32_t key) const {
+    return m_cells[key] >> EPOCH_SHIFT == m_epoch;
+  }
+  void AdvanceEpoch(TaskPool &pool);
+
+  // epoch << EPOCH_SHIFT | particles in the cell
+  std::vector<uint32_t> m_cells;
+  std::vector<uint32_t> m_cellStart;
+  std::vector<uint32_t> m_entries;
+  std::vector<uint32_t> m_occupied;
+  uint32_t m_epoch = 0;
+
+  // keys of the last build and the scratch of Update()
+  std::vector<uint32_t> m_keys;
+  uint32_t m_tableSize = 0;
+  std::vector<uint32_t> m_chunkChanged;
+  std::vector<uint32_t> m_kept;
+  std::vector<uint32_t> m_moved;
+  std::vector<uint32_t> m_movedKeys;
+  RadixSort m_sort;
+};
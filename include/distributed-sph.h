@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "particle.h"
+#include "settings.h"
+#include "sph.h"
+#include "transport.h"
+
+// Totals of the last Update() on this rank
+struct DistributedStats {
+  // copies of the neighbouring slabs' particles the step ran with
+  size_t ghosts = 0;
+  // particles handed to and taken over from the neighbours
+  size_t sent = 0;
+  size_t received = 0;
+  // packing, exchanging and unpacking
+  float exchangeTime = 0;
+};
+
+// The CPU solver on one slab of the box per rank of a Transport. The box is
+// cut along x where the initial particles split into equal shares, each rank
+// owns the particles of its slab and runs Sph on them together with ghost
+// copies of the neighbouring slabs within Settings::haloSupports support
+// radii. Once per Update(), before the step, every rank sends its direct
+// neighbours the particles that crossed into them and the ghosts they need,
+// in one message each. A particle that moved past a whole slab is passed on
+// by the next Update(). Periodic boxes wrap the last slab around to the
+// first. Reordering and adaptive resampling are switched off, both would mix
+// the owned particles and their ghosts.
+class DistributedSph {
+public:
+  DistributedSph(const Settings &settings, Transport &transport);
+
+  // every rank lays out the whole initial block of Sph::Init() and keeps its
+  // slab of it
+  void Init(std::vector<Particle> &particles);
+  // `particles` are the ones this rank owns, migration changes their number
+  // and order
+  void Update(float dt, std::vector<Particle> &particles);
+
+  const DistributedStats &GetStats() const { return m_stats; }
+  const SphStats &GetSphStats() const { return m_sph.GetStats(); }
+  uint32_t GetThreadsNum() const { return m_sph.GetThreadsNum(); }
+  // x of the slab in box coordinates
+  float GetSlabBegin() const { return m_slabBegin; }
+  float GetSlabEnd() const { return m_slabEnd; }
+
+private:
+  void Cut(const std::vector<Particle> &particles);
+  uint32_t Owner(float x) const;
+  // index into m_peers of the neighbour a particle of `owner` goes to first
+  int Towards(uint32_t owner) const;
+  void Exchange(std::vector<Particle> &particles);
+
+  Settings m_settings;
+  Transport &m_transport;
+  Sph m_sph;
+  DistributedStats m_stats;
+  float m_halo = 0;
+  // box x where the slab of rank r + 1 starts
+  std::vector<float> m_cuts;
+  float m_slabBegin = 0;
+  float m_slabEnd = 0;
+  // the distinct neighbouring ranks, left and right index into them (-1 at a
+  // wall)
+  std::vector<uint32_t> m_peers;
+  int m_left = -1;
+  int m_right = -1;
+
+  std::vector<Particle> m_local;
+  std::vector<std::vector<Particle>> m_migrants;
+  std::vector<std::vector<Particle>> m_ghosts;
+  std::vector<std::vector<uint8_t>> m_outgoing;
+  std::vector<std::vector<uint8_t>> m_incoming;
+};
@@ -2,6 +2,7 @@
 
 #include <DirectXMath.h>
 #include <SimpleMath.h>
+#include <stdint.h>
 
 #include <vector>
 
@@ -36,7 +37,7 @@ class HeightField {
   HeightField(const Props& props);
   void Update(float dt);
   void GetRenderData(std::vector<Vector3>& vertecies,
-                     std::vector<UINT16>& indecies);
+                     std::vector<uint16_t>& indecies);
   void StartImpulse(int x, int z, float value, float radius);
   void StopImpulse(int x, int z, float radius);
 
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+
+#include "settings.h"
+
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+// Where a KinematicBody is at some time and how fast it moves there. The
+// rotation is kept as its cosine and sine about the unit axis.
+struct KinematicPose {
+  Vector3 position = Vector3::Zero;
+  Vector3 velocity = Vector3::Zero;
+  Vector3 axis = Vector3(0, 0, 1.f);
+  float angle = 0;
+  float angularVelocity = 0;
+  float cos = 1.f;
+  float sin = 0;
+
+  // world position to pivot space and a pivot space direction to world
+  Vector3 ToLocal(const Vector3 &position) const;
+  Vector3 ToWorld(const Vector3 &direction) const;
+  // velocity of the body at a world position
+  Vector3 VelocityAt(const Vector3 &position) const;
+};
+
+KinematicPose EvaluatePose(const KinematicBody &body, float time);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <DirectXMath.h>
+#include <stdint.h>
 
 #include <list>
 #include <vector>
@@ -36,8 +37,8 @@ private:
   void march_cube(XMINT3 pos, std::vector<Vector3> &vertex);
   bool check_collision(Vector3 point);
   bool check_collision(const Vector3 &point, const Vector3 &particle);
-  const int *get_triangulations(UINT x, UINT y, UINT z);
-  Vector3 get_point(UINT edge_index, XMINT3 pos);
+  const int *get_triangulations(uint32_t x, uint32_t y, uint32_t z);
+  Vector3 get_point(uint32_t edge_index, XMINT3 pos);
 
   struct VoxelGrid {
     std::vector<bool> data;
@@ -7,6 +7,8 @@
 #include <vector>
 
 #include "particle.h"
+#include "radix-sort.h"
+#include "task-pool.h"
 
 using namespace DirectX;
 using namespace DirectX::SimpleMath;
@@ -18,9 +20,29 @@ class NeighbourHash {
 public:
   NeighbourHash() = default;
 
+  // Switches to a collision-free linear index over cellsNum cells, cells
+  // outside the box are clamped to its border.
+  void setDenseGrid(const XMINT3 &cellsNum);
+  uint32_t getTableSize() const;
+
   uint32_t getHash(const XMINT3 &cell);
   XMINT3 getCell(const Particle &p, float h, const Vector3 &offset);
+  // orders particles by their hash as createTable() expects
+  void sortParticles(std::vector<Particle> &particles, TaskPool &pool);
+  // Slots of m carry the epoch of the createTable() call that wrote them, so
+  // the table is not refilled every call; read it through getFirst().
   void createTable(const std::vector<Particle> &sortedParticles);
+  // first sorted particle of the cell, NO_PARTICLE for an empty cell
+  uint32_t getFirst(uint32_t hash) const;
 
   std::vector<uint32_t> m;
+
+private:
+  std::vector<uint32_t> m_epochs;
+  RadixSort m_sort;
+  std::vector<uint32_t> m_keys;
+  std::vector<Particle> m_sorted;
+  uint32_t m_epoch = 0;
+  bool m_dense = false;
+  XMINT3 m_cellsNum = XMINT3(0, 0, 0);
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+#include "particle-soa.h"
+#include "task-pool.h"
+
+// Cached Verlet neighbour lists: all particles within h + skin, stored as one
+// flat index array with a range per particle. Indices refer to the ParticleSoA
+// slots at build time, so the particle order must not change until the next
+// Build(). Valid while no particle has moved more than skin / 2. Distances
+// are taken to the nearest image along the axes where period > 0.
+class NeighbourList {
+public:
+  using CandidateFn = std::function<void(
+      const Vector3 &position, float radius, std::vector<uint32_t> &out)>;
+
+  NeighbourList() = default;
+
+  void Build(const ParticleSoA &soa, float radius, float skin,
+             const Vector3 &period, const CandidateFn &candidates,
+             TaskPool &pool);
+  bool NeedsRebuild(const ParticleSoA &soa, TaskPool &pool) const;
+  void Invalidate() { m_start.clear(); }
+
+  const uint32_t *Begin(size_t i) const { return &m_indices[m_start[i]]; }
+  uint32_t Count(size_t i) const { return m_start[i + 1] - m_start[i]; }
+
+private:
+  float m_skin = 0;
+  Vector3 m_period = Vector3::Zero;
+  std::vector<uint32_t> m_start;
+  std::vector<uint32_t> m_indices;
+  std::vector<Vector3> m_buildPositions;
+  std::vector<std::vector<uint32_t>> m_chunkIndices;
+};
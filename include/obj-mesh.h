@@ -0,0 +1,25 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "task-pool.h"
+
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+// Triangles of a Wavefront OBJ file, the CPU counterpart of the CMO models
+// the renderer loads. Only positions are kept, polygons become fans.
+struct ObjMesh {
+  std::vector<Vector3> vertices;
+  // three per triangle
+  std::vector<uint32_t> indices;
+};
+
+// Parses `path` in chunks of whole lines on the pool, throws
+// std::runtime_error when it can't be read or refers to missing vertices.
+void LoadObj(const std::string &path, ObjMesh &mesh, TaskPool &pool);
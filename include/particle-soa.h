@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "particle.h"
+
+// Structure-of-arrays copy of Particle used by the CPU solver, so neighbour
+// loops only touch the fields they read.
+struct ParticleSoA {
+  std::vector<float> x, y, z;
+  std::vector<float> vx, vy, vz;
+  std::vector<float> fx, fy, fz;
+  std::vector<float> nx, ny, nz;
+  std::vector<float> density;
+  std::vector<float> pressure;
+  std::vector<uint32_t> hash;
+  std::vector<uint32_t> neighbours;
+  // mass in units of Settings::mass, empty while every particle has 1
+  std::vector<float> massScale;
+
+  size_t Size() const { return x.size(); }
+  void Resize(size_t size);
+
+  void Set(size_t i, const Particle &p);
+  Particle Get(size_t i) const;
+  Vector3 Position(size_t i) const { return Vector3(x[i], y[i], z[i]); }
+  Vector3 Velocity(size_t i) const { return Vector3(vx[i], vy[i], vz[i]); }
+
+  // AoS <-> SoA, the vector<Particle> layout is what SphGpu uploads
+  void Load(const std::vector<Particle> &particles);
+  void Store(std::vector<Particle> &particles) const;
+};
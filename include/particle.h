@@ -1,6 +1,7 @@
 #pragma once
 
 #include <SimpleMath.h>
+#include <stdint.h>
 
 using namespace DirectX::SimpleMath;
 using namespace DirectX;
@@ -11,9 +12,9 @@ struct Particle {
   Vector3 force;
   float pressure;
   Vector3 velocity;
-  UINT hash;
+  uint32_t hash;
   Vector3 normal;
-  UINT neighbours;
+  uint32_t neighbours;
 };
 
 struct PBParticle {
@@ -27,6 +28,14 @@ struct PBParticle {
   float mass;
 };
 
+struct IISPHParticle {
+  XMFLOAT3 velocity;
+  XMFLOAT3 pressureAccel;
+  float diagonal;
+  float source;
+  float pressure;
+};
+
 struct Potential {
   float waveCrest;
   float trappedAir;
@@ -38,8 +47,8 @@ struct DiffuseParticle {
   Vector3 position;
   Vector3 velocity;
   // 0 - spray, 1 - foam, 2 - bubbles
-  UINT type;
-  UINT origin;
+  uint32_t type;
+  uint32_t origin;
   float lifetime;
-  UINT neighbours;
+  uint32_t neighbours;
 };
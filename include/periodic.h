@@ -0,0 +1,22 @@
+#pragma once
+
+#include <SimpleMath.h>
+
+#include <cmath>
+
+using namespace DirectX::SimpleMath;
+
+// r between two points of a domain that repeats every period along the axes
+// where period > 0, taken to the nearest image of the second point
+inline Vector3 MinimumImage(Vector3 r, const Vector3 &period) {
+  if (period.x > 0) {
+    r.x -= period.x * std::round(r.x / period.x);
+  }
+  if (period.y > 0) {
+    r.y -= period.y * std::round(r.y / period.y);
+  }
+  if (period.z > 0) {
+    r.z -= period.z * std::round(r.z / period.z);
+  }
+  return r;
+}
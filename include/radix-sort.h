@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "task-pool.h"
+
+// Parallel LSD radix sort of 32-bit keys, 8 bits per pass. It sorts (key,
+// index) pairs and hands out the permutation, so callers gather their records
+// once instead of moving them in every pass. Stable, and passes above the
+// highest set bit of maxKey are skipped.
+class RadixSort {
+public:
+  RadixSort() = default;
+
+  // Order()[i] is the index of the i-th smallest of keys[0..count)
+  void Sort(const uint32_t *keys, size_t count, uint32_t maxKey,
+            TaskPool &pool);
+  const std::vector<uint32_t> &Order() const { return m_order; }
+  // the keys in sorted order
+  const std::vector<uint32_t> &Keys() const { return m_keys; }
+
+private:
+  std::vector<uint32_t> m_keys;
+  std::vector<uint32_t> m_keysTmp;
+  std::vector<uint32_t> m_order;
+  std::vector<uint32_t> m_orderTmp;
+  // digit counts per chunk, then the chunk's first slot of every digit
+  std::vector<uint32_t> m_offsets;
+};
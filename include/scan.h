@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <stddef.h>
+
+#include "task-pool.h"
+
+// Prefix sums over uint32 arrays of any length, the CPU counterpart of
+// ScanCS.hlsl/PrefixSum.cs for cell offsets and stream compaction. Chunks
+// are summed in parallel, the chunk totals are scanned serially and every
+// chunk is then scanned with AVX2 or SSE2 lanes from its offset. `in` and
+// `out` may be the same array. Sums wrap around like uint32 arithmetic.
+
+void InclusiveScan(const uint32_t *in, uint32_t *out, size_t count,
+                   TaskPool &pool);
+
+// out[i] = in[0] + ... + in[i - 1], returns the sum of all of `in`
+uint32_t ExclusiveScan(const uint32_t *in, uint32_t *out, size_t count,
+                       TaskPool &pool);
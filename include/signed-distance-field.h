@@ -0,0 +1,86 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "task-pool.h"
+
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+// closest point to p on the triangle abc
+Vector3 ClosestOnTriangle(const Vector3 &p, const Vector3 &a, const Vector3 &b,
+                          const Vector3 &c);
+
+// Signed distance to solid obstacles, sampled at the corners of a regular
+// grid and negative inside them. Shapes are unioned into the samples when
+// added; lookups interpolate trilinearly in O(1) no matter how many shapes
+// went in. Points outside the grid are far from every obstacle.
+class SignedDistanceField {
+public:
+  // milliseconds of the AddMesh() stages
+  struct MeshStats {
+    float bandTime = 0;
+    float signTime = 0;
+    float sweepTime = 0;
+  };
+
+  SignedDistanceField() = default;
+
+  // clears the field to a grid of samples every cellSize over [min, max]
+  void Reset(const Vector3 &min, const Vector3 &max, float cellSize);
+  bool Empty() const { return m_values.empty(); }
+
+  void AddBox(const Vector3 &center, const Vector3 &halfExtents,
+              TaskPool &pool);
+  void AddSphere(const Vector3 &center, float radius, TaskPool &pool);
+  // capped along y
+  void AddCylinder(const Vector3 &center, float radius, float halfHeight,
+                   TaskPool &pool);
+  // Closed triangle mesh, three indices per triangle. Distances are exact
+  // within MESH_BAND cells of a triangle and carried up to bandWidth away by
+  // fast sweeping of the closest triangles, deeper samples inside get
+  // -bandWidth. The sign is the parity of the surface crossings along x, so
+  // holes in the mesh leave streaks.
+  MeshStats AddMesh(const std::vector<Vector3> &vertices,
+                    const std::vector<uint32_t> &indices, float bandWidth,
+                    TaskPool &pool);
+
+  // distance at `position` and its gradient, the gradient is the one of the
+  // interpolation (not normalized) and zero outside the grid
+  float Distance(const Vector3 &position) const;
+  float Distance(const Vector3 &position, Vector3 &gradient) const;
+
+  // raw samples for generated fields, x fastest
+  XMINT3 GetSamplesNum() const { return m_samplesNum; }
+  Vector3 GetOrigin() const { return m_origin; }
+  float GetCellSize() const { return m_cellSize; }
+  std::vector<float> &Values() { return m_values; }
+
+private:
+  static constexpr int MESH_BAND = 2;
+
+  // union of the samples with the distance function fn(position)
+  template <typename Fn> void Add(Fn &&fn, TaskPool &pool);
+  size_t Index(int x, int y, int z) const {
+    return x + (y + (size_t)z * m_samplesNum.y) * m_samplesNum.x;
+  }
+  float Sample(int x, int y, int z) const {
+    return m_values[Index(x, y, z)];
+  }
+
+  Vector3 m_origin = Vector3::Zero;
+  float m_cellSize = 1.f;
+  XMINT3 m_samplesNum = XMINT3(0, 0, 0);
+  std::vector<float> m_values;
+  // distance of the points outside the grid
+  float m_far = 0;
+
+  // AddMesh() scratch per sample: distance << 32 | closest triangle, x
+  // crossing parity
+  std::vector<uint64_t> m_closest;
+  std::vector<uint8_t> m_crossings;
+};
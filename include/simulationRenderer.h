@@ -52,6 +52,7 @@ private:
   SphGpu m_sphGpuAlgo;
   std::unique_ptr<MCGpu> m_mcGpu;
 
+  std::vector<Particle> m_uploadParticles;
   std::vector<Vector3> m_vertex;
   std::vector<UINT> m_index;
   std::unique_ptr<CommonStates> m_states;
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+
+// Shared by the translation units of the CPU solver, not part of its
+// interface.
+
+// particles per ParallelFor task of the per-particle passes
+const size_t GRAIN = 256;
+
+using Clock = std::chrono::high_resolution_clock;
+
+// the timings of SphStats and DistributedStats
+inline float ElapsedMs(const Clock::time_point &start) {
+  return std::chrono::duration<float, std::milli>(Clock::now() - start)
+      .count();
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Smoothing kernels of the CPU solver as compile-time policies. Normalization
+// constants are folded at compile time, the powers of h are multiplied out
+// once per kernel object and every evaluation is a short polynomial without
+// pow(). W2() takes the squared distance, W(), GradW() (dW/dr) and LapW() the
+// distance, which is assumed to be inside the support - callers mask the rest.
+//
+// The functions are templates over the value type so that the SIMD batches of
+// sph-simd.cpp can use them; a value type provides + - * /, Min, Max, Sqrt and
+// a static Set(float).
+
+namespace kernels {
+
+constexpr float PI = 3.14159265f;
+
+template <typename T> T Splat(float f) { return T::Set(f); }
+template <> inline float Splat<float>(float f) { return f; }
+
+inline float Min(float a, float b) { return std::min(a, b); }
+inline float Max(float a, float b) { return std::max(a, b); }
+inline float Sqrt(float a) { return std::sqrt(a); }
+
+// Mueller et al. 2003 density kernel
+struct Poly6 {
+  static constexpr float W_NORM = 315.0f / (64.0f * PI);
+  static constexpr float GRAD_NORM = -945.0f / (32.0f * PI);
+
+  explicit Poly6(float h) : h2(h * h) {
+    float h3 = h * h * h;
+    float h9 = h3 * h3 * h3;
+    wScale = W_NORM / h9;
+    gradScale = GRAD_NORM / h9;
+  }
+
+  template <typename T> T W2(T r2) const {
+    T w = Splat<T>(h2) - r2;
+    return Splat<T>(wScale) * w * w * w;
+  }
+  template <typename T> T W(T r) const { return W2(r * r); }
+  template <typename T> T GradW(T r) const {
+    T w = Splat<T>(h2) - r * r;
+    return Splat<T>(gradScale) * r * w * w;
+  }
+  template <typename T> T LapW(T r) const {
+    T r2 = r * r;
+    T w = Splat<T>(h2) - r2;
+    return Splat<T>(gradScale) * w *
+           (Splat<T>(3 * h2) - Splat<T>(7) * r2);
+  }
+
+  float h2;
+  float wScale;
+  float gradScale;
+};
+
+// Mueller et al. 2003 pressure kernel. LapW() is the Laplacian of their
+// viscosity kernel, which the solver pairs with the spiky gradient.
+struct Spiky {
+  static constexpr float W_NORM = 15.0f / PI;
+  static constexpr float GRAD_NORM = -45.0f / PI;
+  static constexpr float LAP_NORM = 45.0f / PI;
+
+  explicit Spiky(float h) : h(h) {
+    float h3 = h * h * h;
+    float h6 = h3 * h3;
+    wScale = W_NORM / h6;
+    gradScale = GRAD_NORM / h6;
+    lapScale = LAP_NORM / h6;
+  }
+
+  template <typename T> T W2(T r2) const { return W(Sqrt(r2)); }
+  template <typename T> T W(T r) const {
+    T w = Splat<T>(h) - r;
+    return Splat<T>(wScale) * w * w * w;
+  }
+  template <typename T> T GradW(T r) const {
+    T w = Splat<T>(h) - r;
+    return Splat<T>(gradScale) * w * w;
+  }
+  template <typename T> T LapW(T r) const {
+    return Splat<T>(lapScale) * (Splat<T>(h) - r);
+  }
+
+  float h;
+  float wScale;
+  float gradScale;
+  float lapScale;
+};
+
+// M4 cubic spline with support h. Both pieces are written with clamped terms,
+// so there is no branch per pair.
+struct CubicSpline {
+  static constexpr float NORM = 8.0f / PI;
+
+  explicit CubicSpline(float h) : invH(1 / h) {
+    wScale = NORM * invH * invH * invH;
+    gradScale = wScale * invH;
+    lapScale = gradScale * invH;
+  }
+
+  template <typename T> T W2(T r2) const { return W(Sqrt(r2)); }
+  template <typename T> T W(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Max(Splat<T>(1) - q, Splat<T>(0));
+    T b = Max(Splat<T>(0.5f) - q, Splat<T>(0));
+    return Splat<T>(wScale) *
+           (Splat<T>(2) * a * a * a - Splat<T>(8) * b * b * b);
+  }
+  template <typename T> T GradW(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Max(Splat<T>(1) - q, Splat<T>(0));
+    T b = Max(Splat<T>(0.5f) - q, Splat<T>(0));
+    return Splat<T>(gradScale) *
+           (Splat<T>(24) * b * b - Splat<T>(6) * a * a);
+  }
+  // W'' + 2 W' / r, the inner piece is 72 q - 36, the outer one
+  // 12 (1 - q) (2 q - 1) / q; both vanish at q = 1/2
+  template <typename T> T LapW(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Max(Splat<T>(1) - q, Splat<T>(0));
+    T inner = Splat<T>(72) * Min(q - Splat<T>(0.5f), Splat<T>(0));
+    T outer = Splat<T>(12) * a *
+              Max(Splat<T>(2) * q - Splat<T>(1), Splat<T>(0)) /
+              Max(q, Splat<T>(0.5f));
+    return Splat<T>(lapScale) * (inner + outer);
+  }
+
+  float invH;
+  float wScale;
+  float gradScale;
+  float lapScale;
+};
+
+// Wendland C2 exactly as W, GradW and LapW of shaders/Sph.hlsli, including
+// their normalization, so the CPU density matches the GPU one.
+struct WendlandC2 {
+  static constexpr float NORM = 21.0f / (16.0f * PI);
+
+  explicit WendlandC2(float h) : invH(1 / h) {
+    float invH2 = invH * invH;
+    wScale = NORM * invH2 * invH;
+    gradScale = -5 * NORM * invH2 * invH2 * invH;
+    lapScale = -20 * wScale * invH2;
+  }
+
+  template <typename T> T W2(T r2) const { return W(Sqrt(r2)); }
+  template <typename T> T W(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Splat<T>(1) - q;
+    T a2 = a * a;
+    return Splat<T>(wScale) * a2 * a2 * (Splat<T>(4) * q + Splat<T>(1));
+  }
+  template <typename T> T GradW(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Splat<T>(1) - Splat<T>(0.5f) * q;
+    return Splat<T>(gradScale) * q * a * a * a;
+  }
+  // (1 - q)^4 - (1 - q)^3 (4 q + 1) folded into -5 q (1 - q)^3
+  template <typename T> T LapW(T r) const {
+    T q = r * Splat<T>(invH);
+    T a = Splat<T>(1) - q;
+    return Splat<T>(lapScale) * q * a * a * a;
+  }
+
+  float invH;
+  float wScale;
+  float gradScale;
+  float lapScale;
+};
+
+// Kernels of the three solver terms, the support is h for all of them
+template <typename DensityKernel, typename PressureKernel,
+          typename ViscosityKernel>
+struct KernelSet {
+  explicit KernelSet(float h)
+      : h(h), density(h), pressure(h), viscosity(h) {}
+
+  float h;
+  DensityKernel density;
+  PressureKernel pressure;
+  ViscosityKernel viscosity;
+};
+
+using Mueller = KernelSet<Poly6, Spiky, Spiky>;
+using Cubic = KernelSet<CubicSpline, CubicSpline, CubicSpline>;
+using Wendland = KernelSet<WendlandC2, WendlandC2, WendlandC2>;
+
+} // namespace kernels
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "particle-soa.h"
+#include "sph-kernels.h"
+
+// Neighbour sums of the CPU solver over a list of candidate indices into a
+// ParticleSoA. Built for AVX2 (8 pairs per instruction), SSE (4 pairs) or
+// scalar code depending on the target flags, see ENABLE_AVX2. Instantiated for
+// the kernel sets of sph-kernels.h. Separations are taken to the nearest
+// image along the axes where `period` > 0, see MinimumImage().
+
+struct SphForceParams {
+  Vector3 position;
+  Vector3 velocity;
+  float pressure;
+  float density;
+  // mass of the particle, Settings::mass times its massScale
+  float mass;
+  float massScale;
+  float dynamicViscosity;
+  Vector3 period;
+};
+
+// sum of the density kernel over candidates closer than h, weighted by their
+// ParticleSoA::massScale
+template <typename Kernels>
+float SimdDensitySum(const ParticleSoA &soa, const uint32_t *indices,
+                     uint32_t count, const Vector3 &position,
+                     const Vector3 &period, const Kernels &kernels);
+
+template <typename Kernels>
+void SimdForceSum(const ParticleSoA &soa, const uint32_t *indices,
+                  uint32_t count, const SphForceParams &params,
+                  const Kernels &kernels, Vector3 &pressureGrad,
+                  Vector3 &viscosity);
+
+// Half-shell variant: every candidate pair is evaluated once. The force on the
+// particle itself is returned in `force`, the equal-and-opposite share of
+// candidate c is written to pairX/Y/Z[c] (arrays of SimdPadding(count)).
+template <typename Kernels>
+void SimdForcePairs(const ParticleSoA &soa, const uint32_t *indices,
+                    uint32_t count, const SphForceParams &params,
+                    const Kernels &kernels, Vector3 &force, float *pairX,
+                    float *pairY, float *pairZ);
+
+uint32_t SimdPadding(uint32_t count);
+
+const char *SimdPathName();
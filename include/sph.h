@@ -1,8 +1,58 @@
 #pragma once
 
+#include <stdint.h>
+
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "cell-grid.h"
+#include "kinematic-body.h"
+#include "neighbour-list.h"
+#include "particle-soa.h"
 #include "particle.h"
-#include "pch.h"
+#include "periodic.h"
+#include "radix-sort.h"
 #include "settings.h"
+#include "signed-distance-field.h"
+#include "sph-simd.h"
+#include "task-pool.h"
+
+// Totals of the last Update(), over all of its substeps
+struct SphStats {
+  float hashTime = 0;
+  float densityTime = 0;
+  float forcesTime = 0;
+  float positionsTime = 0;
+  uint32_t neighbourListBuilds = 0;
+  // grid builds merged from the previous one, see gridUpdateFraction
+  uint32_t gridUpdates = 0;
+  // grid searches with Settings::countFalseCandidates, those of the density
+  // pass or, with neighbour lists, of the list builds, and their candidates;
+  // false ones lie outside the cells a search visited and only come from
+  // hash collisions
+  uint64_t candidateSearches = 0;
+  uint64_t candidates = 0;
+  uint64_t falseCandidates = 0;
+  // with Settings::adaptiveTimestep the frame is split into substeps, dt is
+  // the smallest of them
+  uint32_t substeps = 0;
+  float dt = 0;
+  // SphSolver::Implicit Jacobi iterations and the mean compression
+  // (relative to the rest density) the last solve ended with
+  uint32_t pressureIterations = 0;
+  float densityError = 0;
+  // particles the density and force passes evaluated, summed over substeps,
+  // the rest sleeps or waits for its level boundary, see Settings::sleepSteps
+  // and Settings::timeStepLevels
+  uint64_t activeParticles = 0;
+  // adaptive resolution, pairs merged and particles split over the frame
+  uint32_t merged = 0;
+  uint32_t split = 0;
+};
+
+// particle spacing of Init() in units of h
+const float INIT_SPACING = 0.9f;
 
 class Sph {
 public:
@@ -11,15 +61,235 @@ public:
   void Update(float dt, std::vector<Particle> &particles);
   void CheckBoundary(Particle &p);
 
-  UINT GetHash(XMINT3 cell);
-  XMINT3 GetCell(Vector3 pos);
+  // Update() permutes `particles` along a Morton curve every
+  // Settings::reorderInterval steps; the id of particles[i] is GetIds()[i],
+  // ids are the indices after Init() or the last adaptive resample, which
+  // changes the particle count.
+  const std::vector<uint32_t> &GetIds() const { return m_ids; }
+  // copies `particles` to `out` with every particle at the index of its id
+  void ToIdOrder(const std::vector<Particle> &particles,
+                 std::vector<Particle> &out);
+  // the caller replaced particles between two Update()s, which can't reuse
+  // the neighbour lists of the old ones then
+  void ParticlesChanged() { m_particlesChanged = true; }
+
+  // cells wrap around the periodic axes in both
+  uint32_t GetHash(XMINT3 cell) const;
+  XMINT3 GetCell(Vector3 pos) const;
+
+  const SphStats &GetStats() const { return m_stats; }
+  float GetSupportRadius() const { return SupportRadius(); }
+  size_t GetBoundaryParticlesNum() const { return m_boundary.Size(); }
+  uint32_t GetThreadsNum() const { return m_pool.GetThreadsNum(); }
 
 private:
+  void Reorder(std::vector<Particle> &particles);
+  // moves particles (and their ids and masses) into the order of the last
+  // m_sort
+  void GatherSorted(std::vector<Particle> &particles);
+  // the kernel set is picked once per step, the passes are compiled for each
+  template <typename Fn> void DispatchKernels(float support, Fn &&fn) {
+    switch (m_settings.kernel) {
+    case SphKernel::Mueller:
+      fn(kernels::Mueller(support));
+      break;
+    case SphKernel::CubicSpline:
+      fn(kernels::Cubic(support));
+      break;
+    case SphKernel::Wendland:
+      fn(kernels::Wendland(support));
+      break;
+    }
+  }
+
+  float LatticeDensity(float support);
+  float SupportRadius() const;
+  void UpdateForces(std::vector<Particle> &particles, bool reordered);
+  // IISPH pressure on top of the forces of UpdateForces(), sph-iisph.cpp
+  void SolvePressure(float dt);
+  template <typename Kernels> void IisphSolve(const Kernels &kernels, float dt);
+  // advances positions by dt, velocities by KickStep()
+  void Integrate(float dt, std::vector<Particle> &particles);
+  float StableTimestep();
+
+  // Position Based Fluids, sph-pbf.cpp
+  void PbfStep(float dt, std::vector<Particle> &particles);
+  template <typename Kernels>
+  void PbfSolve(const Kernels &kernels, float dt);
+  void ClampToBoundary(Vector3 &position) const;
+
+  // cell sleeping, sph-sleep.cpp
+  bool SleepEnabled() const;
+  void MarkAsleep();
+  void TrackMotion(size_t i, float previousDensity);
+  void Wake(size_t i);
+  bool NeighbourhoodMoved(const XMINT3 &cell) const;
+  void UpdateRest();
+  bool Asleep(size_t i) const { return !m_asleep.empty() && m_asleep[i]; }
+
+  // multi-rate time stepping, sph-multirate.cpp
+  bool MultiRateEnabled() const;
+  void MultiRateStep(float dt, std::vector<Particle> &particles,
+                     bool reordered);
+  void AssignLevels(float dt);
+  void MarkWaiting();
+  float KickStep(uint32_t index, float dt) const;
+  bool Waiting(size_t i) const { return !m_waiting.empty() && m_waiting[i]; }
+  // left out of the density and force passes
+  bool Skipped(size_t i) const { return Asleep(i) || Waiting(i); }
+
+  // signed distance field obstacles, sph-obstacles.cpp
+  void BuildObstacles();
+  // bakes the union of shapes into field
+  void BuildField(std::span<const Obstacle> shapes,
+                  SignedDistanceField &field);
+  Vector3 ObstacleAcceleration(const Vector3 &position) const;
+  void CollideObstacles(Particle &p) const;
+  void ClampToObstacles(Vector3 &position) const;
+
+  // scripted kinematic bodies, sph-kinematic.cpp
+  void BuildKinematics();
+  void UpdateKinematics(float time);
+  // true when a body touched the particle
+  bool CollideKinematics(Particle &p) const;
+  void ClampToKinematics(Vector3 &position) const;
+
+  // boundary particles, sph-boundary.cpp
+  bool BoundaryEnabled() const;
+  void BuildBoundary();
+  void SampleBox(std::vector<Vector3> &positions) const;
+  void SampleObstacles(std::vector<Vector3> &positions) const;
+  template <typename Kernels>
+  float BoundaryDensity(const Kernels &kernels, size_t i,
+                        std::vector<uint32_t> &candidates) const;
+  template <typename Kernels>
+  Vector3 BoundaryForce(const Kernels &kernels, size_t i,
+                        std::vector<uint32_t> &candidates) const;
+
+  // adaptive resolution, sph-adaptive.cpp
+  void Resample(std::vector<Particle> &particles);
+  template <typename Kernels> void DetectSurface(const Kernels &kernels);
+  void PairParticles();
+  void WriteResampled(std::vector<Particle> &particles);
+
+  void BuildGrid(const std::vector<Particle> &particles);
+  void SortKeys();
+  void GatherParticles(const std::vector<Particle> &particles);
+  std::span<const uint32_t> Neighbours(size_t i, bool useList,
+                                       std::vector<uint32_t> &candidates) const;
+  void GatherCandidates(const Vector3 &position, float radius,
+                        std::vector<uint32_t> &candidates) const {
+    GatherCandidates(m_grid, position, radius, candidates);
+  }
+  // slots of `grid` in the cells around position
+  void GatherCandidates(const CellGrid &grid, const Vector3 &position,
+                        float radius, std::vector<uint32_t> &candidates) const;
+  void AppendCell(const CellGrid &grid, uint32_t key,
+                  std::vector<uint32_t> &candidates) const;
+  NeighbourList::CandidateFn ListCandidates();
+  uint32_t CountFalseCandidates(const Vector3 &position, float radius,
+                                std::span<const uint32_t> candidates) const;
+  void CountCandidates(uint64_t searches, uint64_t candidates,
+                       uint64_t falseCandidates);
+  XMINT3 ClampCell(const XMINT3 &cell) const;
+  XMINT3 WrapCell(const XMINT3 &cell) const;
+  // to - from, the shorter way around along the periodic axes
+  XMINT3 CellOffset(const XMINT3 &from, const XMINT3 &to) const;
+  // every cell is inside along the periodic axes
+  bool InsideGrid(const XMINT3 &cell) const;
+  // a - b to the nearest image, and a position moved into the periodic box
+  Vector3 Separation(const Vector3 &a, const Vector3 &b) const {
+    return MinimumImage(a - b, m_period);
+  }
+  void WrapPosition(Vector3 &position) const;
+  void HalfShellNeighbours(size_t i, bool useList,
+                           std::vector<uint32_t> &candidates) const;
+  SphForceParams ForceParams() const;
+  void SetParticleMass(size_t i, SphForceParams &params) const;
+  template <typename Kernels> void Solve(const Kernels &kernels, bool useList);
+  template <typename Kernels>
+  void ComputeDensity(const Kernels &kernels, bool useList);
+  template <typename Kernels>
+  void ComputeForces(const Kernels &kernels, bool useList);
+  template <typename Kernels>
+  void ComputeForcesHalfShell(const Kernels &kernels, bool useList);
+
   const Settings &m_settings;
-  std::unordered_multimap<UINT, Particle const *> m_hashM;
+  TaskPool m_pool;
+  CellGrid m_grid;
+  std::vector<uint32_t> m_keys;
+  ParticleSoA m_soa;
+  NeighbourList m_neighbourList;
+  SphStats m_stats;
+  // cells of the boundary box and the size of the cell table in either mode
+  XMINT3 m_cellsNum = XMINT3(0, 0, 0);
+  uint32_t m_tableSize = 0;
+  // boundaryLen along the periodic axes, 0 along the others
+  Vector3 m_period = Vector3::Zero;
+
+  std::vector<uint32_t> m_ids;
+  uint32_t m_stepsSinceReorder = 0;
+  std::vector<std::pair<uint64_t, uint32_t>> m_mortonOrder;
+  std::vector<uint32_t> m_mortonKeys;
+  RadixSort m_sort;
+  std::vector<Particle> m_reordered;
+  std::vector<uint32_t> m_reorderedIds;
+  std::vector<float> m_chunkMax;
+  // half-shell forces of the stripes after the first, see
+  // ComputeForcesHalfShell()
+  std::vector<std::vector<Vector3>> m_stripeForces;
+
+  // cell-ordered state of the position based solver
+  std::vector<PBParticle> m_pbParticles;
+  std::vector<Vector3> m_predicted;
+  std::vector<IISPHParticle> m_iisph;
+  // IISPH compression per ParallelFor chunk
+  std::vector<float> m_chunkCompression;
+
+  // per slot of m_soa, and steps at rest / stamp of the last motion per key
+  std::vector<uint8_t> m_asleep;
+  std::vector<uint8_t> m_cellRest;
+  std::vector<uint8_t> m_cellMoved;
+  uint8_t m_sleepStamp = 0;
+
+  // mass of particles[i] in units of Settings::mass, empty while all are 1;
+  // per slot of m_soa: neighbour rings to the surface, resample action, merge
+  // partner and output offset
+  std::vector<float> m_massScale;
+  std::vector<float> m_reorderedMass;
+  std::vector<uint8_t> m_surfaceDistance;
+  std::vector<uint8_t> m_surfaceDistanceNext;
+  std::vector<uint8_t> m_resampleAction;
+  std::vector<uint32_t> m_partner;
+  std::vector<uint32_t> m_resampleOffset;
+  uint32_t m_stepsSinceResample = 0;
+  // the next Update() rebuilds the grid and the neighbour lists
+  bool m_particlesChanged = false;
+
+  // time step level of particles[i] during a multi-rate Update(), the frame
+  // is split into 2^(m_levelsNum - 1) substeps; per slot of m_soa: not at a
+  // boundary of its level in the current substep, and its level before the
+  // neighbours raise it
+  std::vector<uint8_t> m_level;
+  std::vector<uint8_t> m_slotLevel;
+  std::vector<uint8_t> m_waiting;
+  uint32_t m_levelsNum = 1;
+  uint32_t m_substep = 0;
+  float m_frameDt = 0;
+
+  // union of Settings::obstacles
+  SignedDistanceField m_obstacles;
+
+  // per kinematic body: its shape in pivot space and the pose of the current
+  // frame, m_time is the simulated time since Init()
+  std::vector<SignedDistanceField> m_bodyFields;
+  std::vector<KinematicPose> m_bodyPoses;
+  float m_time = 0;
 
-  float poly6;
-  float h2;
-  float spikyGrad;
-  float spikyLap;
+  // boundary particles in the slot order of their static grid, massScale
+  // holds restDensity * volume / mass
+  ParticleSoA m_boundary;
+  CellGrid m_boundaryGrid;
+  // per key, set where a cell or one of its neighbours has boundary particles
+  std::vector<uint8_t> m_boundaryNear;
 };
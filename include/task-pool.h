@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running data-parallel loops. Every worker owns
+// a deque of chunks, pops its own chunks from the front and steals from the
+// back of the other deques once it runs dry. The calling thread takes part as
+// worker 0, so a pool of one thread runs everything inline.
+class TaskPool {
+public:
+  using Task = std::function<void(size_t begin, size_t end)>;
+
+  // threadsNum == 0 uses every hardware thread
+  explicit TaskPool(uint32_t threadsNum = 0);
+  ~TaskPool();
+
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  uint32_t GetThreadsNum() const { return (uint32_t)m_queues.size(); }
+
+  // Runs task over [begin, end) split into chunks of at most grain items and
+  // returns once every chunk is done. Not reentrant.
+  void ParallelFor(size_t begin, size_t end, size_t grain, const Task &task);
+
+private:
+  struct alignas(64) Queue {
+    std::mutex mutex;
+    std::deque<uint32_t> chunks;
+  };
+
+  void WorkerLoop(uint32_t worker);
+  void RunChunks(uint32_t worker);
+  bool PopChunk(uint32_t worker, uint32_t &chunk);
+  bool StealChunk(uint32_t worker, uint32_t &chunk);
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+  uint64_t m_generation = 0;
+  bool m_stop = false;
+
+  const Task *m_task = nullptr;
+  size_t m_begin = 0;
+  size_t m_end = 0;
+  size_t m_grain = 1;
+  std::atomic<uint32_t> m_remaining = 0;
+};
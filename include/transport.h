@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Message passing between the ranks of a distributed run, DistributedSph only
+// talks to its peers through it. A message is an opaque byte buffer, both
+// sides run the same binary on the same kind of machine.
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  virtual uint32_t GetRank() const = 0;
+  virtual uint32_t GetSize() const = 0;
+
+  // Sends outgoing[i] to peers[i] and receives the next message of each peer
+  // into incoming[i]. Every listed peer must list this rank in its own call,
+  // sends and receives make progress together so large messages don't stall
+  // on each other. Throws std::runtime_error when a peer is gone.
+  virtual void Exchange(std::span<const uint32_t> peers,
+                        const std::vector<std::vector<uint8_t>> &outgoing,
+                        std::vector<std::vector<uint8_t>> &incoming) = 0;
+
+  // sum of value over all ranks, on every rank
+  double Sum(double value);
+};
+
+#ifndef _WIN32
+// Ranks as processes on one machine, connected pairwise by Unix domain
+// sockets. Fork() makes the sockets and starts ranks 1..size-1 as children of
+// the calling process, which stays rank 0; every process returns from it with
+// its own rank. Fork before any threads are started.
+class SocketTransport : public Transport {
+public:
+  static std::unique_ptr<SocketTransport> Fork(uint32_t size);
+  ~SocketTransport() override;
+
+  SocketTransport(const SocketTransport &) = delete;
+  SocketTransport &operator=(const SocketTransport &) = delete;
+
+  uint32_t GetRank() const override { return m_rank; }
+  uint32_t GetSize() const override { return (uint32_t)m_sockets.size(); }
+
+  void Exchange(std::span<const uint32_t> peers,
+                const std::vector<std::vector<uint8_t>> &outgoing,
+                std::vector<std::vector<uint8_t>> &incoming) override;
+
+  // Closes the sockets, rank 0 then waits for the children. Returns ok, on
+  // rank 0 only if every child exited with 0 too.
+  bool Finish(bool ok);
+
+private:
+  SocketTransport(uint32_t rank, std::vector<int> sockets,
+                  std::vector<int> children)
+      : m_rank(rank), m_sockets(std::move(sockets)),
+        m_children(std::move(children)) {}
+
+  uint32_t m_rank = 0;
+  // socket to every rank, -1 for the own one
+  std::vector<int> m_sockets;
+  // process ids of ranks 1.., on rank 0
+  std::vector<int> m_children;
+};
+#endif
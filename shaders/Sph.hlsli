@@ -103,8 +103,9 @@ float W(float r, float h) {
   float q = r / h;
   if (q > 1.0f)
     return 0.0f;
-  float alpha_d = 21.0f / (16.0f * 3.14159265359f * pow(h, 3));
-  float factor = pow(1.0f - q, 4) * (4.0f * q + 1.0f);
+  float alpha_d = 21.0f / (16.0f * 3.14159265359f * h * h * h);
+  float a2 = (1.0f - q) * (1.0f - q);
+  float factor = a2 * a2 * (4.0f * q + 1.0f);
   return alpha_d * factor;
 }
 
@@ -114,7 +115,8 @@ float GradW(float r, float h) {
   if (q > 2.0f)
     return 0;
   float alpha_d = 21.0f / (16.0f * 3.14159265359f);
-  float factor = -5.f / pow(h, 5) * q * pow(1.f - q / 2, 3);
+  float a = 1.f - q / 2;
+  float factor = -5.f / (h * h * h * h * h) * q * a * a * a;
   return alpha_d * factor;
 }
 
@@ -123,10 +125,10 @@ float LapW(float r, float h) {
   float q = r / h;
   if (q > 1.0f)
     return 0.0f;
-  float alpha_d = 21.0f / (16.0f * 3.14159265359f * pow(h, 3));
-  float term1 = pow(1.0f - q, 4);
-  float term2 = pow(1.0f - q, 3) * (4.0f * q + 1.0f);
-  float laplacian = (4.0f / (h * h)) * (term1 - term2);
+  float alpha_d = 21.0f / (16.0f * 3.14159265359f * h * h * h);
+  float a3 = (1.0f - q) * (1.0f - q) * (1.0f - q);
+  // (1 - q)^4 - (1 - q)^3 * (4q + 1)
+  float laplacian = (4.0f / (h * h)) * (-5.0f * q * a3);
   return alpha_d * laplacian;
 }
 
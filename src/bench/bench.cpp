@@ -0,0 +1,753 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "distributed-sph.h"
+#include "obj-mesh.h"
+#include "particle.h"
+#include "scan.h"
+#include "settings.h"
+#include "signed-distance-field.h"
+#include "sph-simd.h"
+#include "sph.h"
+#include "task-pool.h"
+#include "transport.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+struct Scenario {
+  const char *name;
+  XMINT3 initCube;
+  Vector3 initLocalPos;
+};
+
+// dam-break matches the renderer's default scene, the others are smaller
+// variants that fit a quick regression run.
+const Scenario SCENARIOS[] = {
+    {"dam-break", XMINT3(128, 64, 128), Vector3(1.f, 1.f, 1.f)},
+    {"small-dam", XMINT3(32, 32, 32), Vector3(1.f, 1.f, 1.f)},
+    {"drop", XMINT3(32, 32, 32), Vector3(6.f, 4.f, 6.f)},
+};
+
+struct Options {
+  std::string scenario = "small-dam";
+  uint32_t steps = 100;
+  uint32_t threads = 0;
+  float skin = 0;
+  float dt = 0;
+  bool denseCells = false;
+  bool fullForces = false;
+  uint32_t reorderInterval = 0;
+  float gridUpdate = -1;
+  bool adaptive = false;
+  std::string solver = "wcsph";
+  uint32_t iterations = 0;
+  uint32_t sleepSteps = 0;
+  uint32_t resampleInterval = 0;
+  uint32_t timeStepLevels = 1;
+  bool obstacles = false;
+  bool boundaryParticles = false;
+  float obstacleRepulsion = 0;
+  std::string waveMaker;
+  bool periodic = false;
+  uint32_t ranks = 1;
+  size_t scanLength = 0;
+  std::string voxelizePath;
+  uint32_t voxelizeSamples = 256;
+  bool countCandidates = false;
+  bool customCube = false;
+  XMINT3 cube = XMINT3(0, 0, 0);
+};
+
+void PrintUsage() {
+  std::cout << "usage: wat24_bench [--scenario name] [--steps n] [--dt sec]"
+               " [--cube x y z] [--threads n]"
+               " [--skin len] [--dense] [--full-forces] [--count-candidates]"
+               " [--reorder steps] [--grid-update fraction] [--adaptive]"
+               " [--solver wcsph|pbf|iisph] [--iterations n] [--sleep steps]"
+               " [--resample steps] [--levels n]"
+               " [--obstacles] [--repulsion stiffness] [--boundary-particles]"
+               " [--wave-maker piston|flap] [--periodic] [--ranks n]"
+            << std::endl;
+  std::cout << "       wat24_bench --scan length [--threads n]" << std::endl;
+  std::cout << "       wat24_bench --voxelize file.obj [samples] [--threads n]"
+            << std::endl;
+  std::cout << "scenarios:";
+  for (auto &s : SCENARIOS) {
+    std::cout << " " << s.name;
+  }
+  std::cout << std::endl;
+}
+
+bool ParseOptions(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; ++i) {
+    auto arg = std::string(argv[i]);
+    auto hasValues = [&](int n) { return i + n < argc; };
+
+    if (arg == "--scenario" && hasValues(1)) {
+      opt.scenario = argv[++i];
+    } else if (arg == "--steps" && hasValues(1)) {
+      opt.steps = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--threads" && hasValues(1)) {
+      opt.threads = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--skin" && hasValues(1)) {
+      opt.skin = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--reorder" && hasValues(1)) {
+      opt.reorderInterval = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--grid-update" && hasValues(1)) {
+      opt.gridUpdate = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--adaptive") {
+      opt.adaptive = true;
+    } else if (arg == "--solver" && hasValues(1)) {
+      opt.solver = argv[++i];
+    } else if (arg == "--sleep" && hasValues(1)) {
+      opt.sleepSteps = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--levels" && hasValues(1)) {
+      opt.timeStepLevels = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--wave-maker" && hasValues(1)) {
+      opt.waveMaker = argv[++i];
+    } else if (arg == "--periodic") {
+      opt.periodic = true;
+    } else if (arg == "--ranks" && hasValues(1)) {
+      opt.ranks = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--boundary-particles") {
+      opt.boundaryParticles = true;
+    } else if (arg == "--obstacles") {
+      opt.obstacles = true;
+    } else if (arg == "--repulsion" && hasValues(1)) {
+      opt.obstacles = true;
+      opt.obstacleRepulsion = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--resample" && hasValues(1)) {
+      opt.resampleInterval = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--voxelize" && hasValues(1)) {
+      opt.voxelizePath = argv[++i];
+      if (hasValues(1) && argv[i + 1][0] != '-') {
+        opt.voxelizeSamples = std::strtoul(argv[++i], nullptr, 10);
+      }
+    } else if (arg == "--scan" && hasValues(1)) {
+      opt.scanLength = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--iterations" && hasValues(1)) {
+      opt.iterations = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--dense") {
+      opt.denseCells = true;
+    } else if (arg == "--full-forces") {
+      opt.fullForces = true;
+    } else if (arg == "--count-candidates") {
+      opt.countCandidates = true;
+    } else if (arg == "--dt" && hasValues(1)) {
+      opt.dt = std::strtof(argv[++i], nullptr);
+    } else if (arg == "--cube" && hasValues(3)) {
+      opt.customCube = true;
+      opt.cube.x = std::atoi(argv[++i]);
+      opt.cube.y = std::atoi(argv[++i]);
+      opt.cube.z = std::atoi(argv[++i]);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+double PeakRssMb() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters = {};
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// Hardware cache misses of the process and the threads it starts while the
+// counter is open. Inherited counts arrive when those threads exit, so Read()
+// goes after the solver is destroyed. -1 where there is no such counter.
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+#endif
+  }
+
+  int64_t Read() const {
+#ifdef __linux__
+    int64_t count = 0;
+    if (m_fd >= 0 && read(m_fd, &count, sizeof(count)) == sizeof(count)) {
+      return count;
+    }
+#endif
+    return -1;
+  }
+
+private:
+  int m_fd = -1;
+};
+
+// The moving wall of Positions.cs as a looping piston at the low x wall, or
+// a flap hinged on the floor in front of it; both span the tank along z.
+bool AddWaveMaker(const std::string &name, Settings &settings) {
+  const Vector3 &len = settings.boundaryLen;
+  const Vector3 &offset = settings.worldOffset;
+  const float &h = settings.h;
+  KinematicBody body;
+  body.shape.shape = ObstacleShape::Box;
+  if (name == "piston") {
+    // the front face is the pivot, 0.33 of the tank at full stroke
+    const float period = 4.f;
+    const float stroke = 0.33f * len.x;
+    body.shape.center = Vector3(-0.25f, 0.5f * len.y, 0.5f * len.z);
+    body.shape.size = Vector3(0.25f, 0.5f * len.y + h, 0.5f * len.z + h);
+    body.axis = Vector3(0, 1.f, 0);
+    body.period = period;
+    const int frames = 8;
+    for (int k = 0; k <= frames; ++k) {
+      float phase = XM_2PI * k / frames;
+      float x = 0.5f * stroke * (1 - std::cos(phase));
+      body.keyframes.push_back(
+          {k * period / frames, offset + Vector3(x, 0, 0)});
+    }
+  } else if (name == "flap") {
+    // swings 0.35 rad towards +x and back, a negative angle about +z
+    const float period = 1.5f;
+    const float height = 4.f;
+    body.shape.center = Vector3(0, 0.5f * height, 0);
+    body.shape.size = Vector3(0.05f, 0.5f * height, 0.5f * len.z + h);
+    body.axis = Vector3(0, 0, 1.f);
+    body.period = period;
+    Vector3 hinge = offset + Vector3(0.5f, 0, 0.5f * len.z);
+    body.keyframes = {{0, hinge, 0},
+                      {0.5f * period, hinge, -0.35f},
+                      {period, hinge, 0}};
+  } else {
+    return false;
+  }
+  settings.kinematicBodies.push_back(body);
+  return true;
+}
+
+struct RunResult {
+  SphStats sum;
+  // at the end of the run, adaptive resolution changes it
+  size_t particlesNum = 0;
+  size_t initialParticlesNum = 0;
+  size_t boundaryParticlesNum = 0;
+  uint32_t threadsNum = 0;
+  double initMs = 0;
+  double totalSec = 0;
+  int64_t cacheMisses = -1;
+};
+
+RunResult Run(const Settings &settings, uint32_t steps, float dt) {
+  using Clock = std::chrono::high_resolution_clock;
+
+  RunResult result;
+  CacheMissCounter counter;
+  {
+    std::vector<Particle> particles;
+    Sph sph(settings);
+
+    auto initStart = Clock::now();
+    sph.Init(particles);
+    result.initialParticlesNum = particles.size();
+    result.boundaryParticlesNum = sph.GetBoundaryParticlesNum();
+    result.initMs =
+        std::chrono::duration<double, std::milli>(Clock::now() - initStart)
+            .count();
+
+    SphStats &sum = result.sum;
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < steps; ++i) {
+      sph.Update(dt, particles);
+
+      auto &stats = sph.GetStats();
+      sum.hashTime += stats.hashTime;
+      sum.densityTime += stats.densityTime;
+      sum.forcesTime += stats.forcesTime;
+      sum.positionsTime += stats.positionsTime;
+      sum.neighbourListBuilds += stats.neighbourListBuilds;
+      sum.gridUpdates += stats.gridUpdates;
+      sum.candidateSearches += stats.candidateSearches;
+      sum.candidates += stats.candidates;
+      sum.falseCandidates += stats.falseCandidates;
+      sum.substeps += stats.substeps;
+      sum.pressureIterations += stats.pressureIterations;
+      sum.activeParticles += stats.activeParticles;
+      sum.merged += stats.merged;
+      sum.split += stats.split;
+      sum.densityError = stats.densityError;
+      sum.dt = i == 0 ? stats.dt : std::min(sum.dt, stats.dt);
+    }
+    result.totalSec =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    result.particlesNum = particles.size();
+    result.threadsNum = sph.GetThreadsNum();
+  }
+  result.cacheMisses = counter.Read();
+  return result;
+}
+
+#ifndef _WIN32
+// One forked process per rank, each running DistributedSph on its slab with
+// its own threads; rank 0 prints the totals.
+int RunDistributed(const Settings &settings, const Options &opt, float dt) {
+  using Clock = std::chrono::high_resolution_clock;
+
+  std::unique_ptr<SocketTransport> transport;
+  try {
+    transport = SocketTransport::Fork(opt.ranks);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  const uint32_t rank = transport->GetRank();
+
+  bool ok = true;
+  try {
+    std::vector<Particle> particles;
+    DistributedSph sph(settings, *transport);
+    sph.Init(particles);
+
+    double ghosts = 0;
+    double sent = 0;
+    double exchangeMs = 0;
+    SphStats sum;
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < opt.steps; ++i) {
+      sph.Update(dt, particles);
+
+      auto &stats = sph.GetStats();
+      ghosts += stats.ghosts;
+      sent += stats.sent;
+      exchangeMs += stats.exchangeTime;
+      auto &sphStats = sph.GetSphStats();
+      sum.hashTime += sphStats.hashTime;
+      sum.densityTime += sphStats.densityTime;
+      sum.forcesTime += sphStats.forcesTime;
+      sum.positionsTime += sphStats.positionsTime;
+    }
+    double totalSec =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    // every rank takes part in every sum
+    std::vector<double> slabs(opt.ranks);
+    for (uint32_t r = 0; r < opt.ranks; ++r) {
+      slabs[r] = transport->Sum(r == rank ? (double)particles.size() : 0);
+    }
+    const double ranks = opt.ranks;
+    const double steps = std::max(opt.steps, 1u);
+    const double particlesNum = transport->Sum((double)particles.size());
+    ghosts = transport->Sum(ghosts) / (ranks * steps);
+    sent = transport->Sum(sent) / steps;
+    exchangeMs = transport->Sum(exchangeMs) / (ranks * steps);
+    double solveMs = transport->Sum(sum.hashTime + sum.densityTime +
+                                    sum.forcesTime + sum.positionsTime) /
+                     (ranks * steps);
+    totalSec = transport->Sum(totalSec) / ranks;
+
+    if (rank == 0) {
+      std::cout << std::fixed << std::setprecision(3);
+      std::cout << "scenario:             " << opt.scenario << std::endl;
+      std::cout << "particles:            " << (size_t)particlesNum
+                << std::endl;
+      std::cout << "ranks:                " << opt.ranks << " ("
+                << sph.GetThreadsNum() << " threads each)" << std::endl;
+      std::cout << "simd:                 " << SimdPathName() << std::endl;
+      std::cout << "solver:               " << opt.solver << std::endl;
+      std::cout << "cells:                "
+                << (opt.denseCells ? "dense" : "hashed")
+                << (opt.periodic ? ", periodic x/z" : "") << std::endl;
+      std::cout << "forces:               "
+                << (opt.fullForces ? "full neighbourhood" : "half shell")
+                << std::endl;
+      std::cout << "steps:                " << opt.steps << " (dt " << dt
+                << ")" << std::endl;
+      std::cout << "total sec:            " << totalSec << std::endl;
+      std::cout << "particle-steps/sec:   "
+                << particlesNum * (double)opt.steps / totalSec << std::endl;
+      std::cout << "slab particles:      ";
+      for (double slab : slabs) {
+        std::cout << " " << (size_t)slab;
+      }
+      std::cout << std::endl;
+      std::cout << "ghosts/rank:          " << ghosts << std::endl;
+      std::cout << "migrated/step:        " << sent << std::endl;
+      std::cout << "solve ms/step:        " << solveMs << std::endl;
+      std::cout << "exchange ms/step:     " << exchangeMs << std::endl;
+      std::cout << "peak RSS MB (rank 0): " << PeakRssMb() << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "rank " << rank << ": " << e.what() << std::endl;
+    ok = false;
+  }
+  return transport->Finish(ok) ? 0 : 1;
+}
+#endif
+
+// Distance field of a mesh on a cube of samples^3 around it with a band of
+// bandCells, checked against the exact distance to all triangles at the band
+// samples among a few spread over the grid.
+int RunVoxelize(const Options &opt) {
+  using Clock = std::chrono::high_resolution_clock;
+  auto elapsedMs = [](const Clock::time_point &start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+  };
+  const uint32_t checks = 20000;
+  const float bandCells = 8;
+  TaskPool pool(opt.threads);
+
+  ObjMesh mesh;
+  auto start = Clock::now();
+  try {
+    LoadObj(opt.voxelizePath, mesh, pool);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  double parseMs = elapsedMs(start);
+  if (mesh.vertices.empty() || opt.voxelizeSamples < 2) {
+    std::cerr << "Nothing to voxelize" << std::endl;
+    return 1;
+  }
+
+  Vector3 min = mesh.vertices[0];
+  Vector3 max = min;
+  for (auto &v : mesh.vertices) {
+    min = Vector3::Min(min, v);
+    max = Vector3::Max(max, v);
+  }
+  Vector3 size = max - min;
+  float cellSize = std::max({size.x, size.y, size.z}) /
+                   (opt.voxelizeSamples - 1 - 4);
+  Vector3 center = (min + max) / 2;
+  Vector3 half = Vector3(cellSize * (opt.voxelizeSamples - 1) / 2);
+  SignedDistanceField field;
+  start = Clock::now();
+  field.Reset(center - half, center + half, cellSize);
+  double resetMs = elapsedMs(start);
+  start = Clock::now();
+  auto stats =
+      field.AddMesh(mesh.vertices, mesh.indices, bandCells * cellSize, pool);
+  double voxelizeMs = elapsedMs(start);
+
+  const XMINT3 n = field.GetSamplesNum();
+  const auto &values = field.Values();
+  size_t inside = std::count_if(values.begin(), values.end(),
+                                [](float v) { return v < 0; });
+  // |value| against the brute force distance to every triangle
+  double maxError = 0;
+  uint32_t checked = 0;
+  for (uint32_t c = 0; c < checks; ++c) {
+    size_t s = (c * 2654435761ull) % values.size();
+    Vector3 p = field.GetOrigin() +
+                cellSize * Vector3((float)(s % n.x), (float)(s / n.x % n.y),
+                                   (float)(s / ((size_t)n.x * n.y)));
+    float exact = std::numeric_limits<float>::max();
+    for (size_t t = 0; t < mesh.indices.size(); t += 3) {
+      Vector3 closest = ClosestOnTriangle(p, mesh.vertices[mesh.indices[t]],
+                                          mesh.vertices[mesh.indices[t + 1]],
+                                          mesh.vertices[mesh.indices[t + 2]]);
+      exact = std::min(exact, (p - closest).Length());
+    }
+    if (exact >= bandCells * cellSize) {
+      continue;
+    }
+    checked++;
+    maxError =
+        std::max<double>(maxError, std::abs(std::abs(values[s]) - exact));
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "mesh:                 " << opt.voxelizePath << std::endl;
+  std::cout << "vertices/triangles:   " << mesh.vertices.size() << " / "
+            << mesh.indices.size() / 3 << std::endl;
+  std::cout << "samples:              " << n.x << "x" << n.y << "x" << n.z
+            << std::endl;
+  std::cout << "threads:              " << pool.GetThreadsNum() << std::endl;
+  std::cout << "parse ms:             " << parseMs << std::endl;
+  std::cout << "grid ms:              " << resetMs << std::endl;
+  std::cout << "band ms:              " << stats.bandTime << std::endl;
+  std::cout << "sign ms:              " << stats.signTime << std::endl;
+  std::cout << "sweep ms:             " << stats.sweepTime << std::endl;
+  std::cout << "voxelize ms:          " << voxelizeMs << std::endl;
+  std::cout << "inside fraction:      " << 100.0 * inside / values.size() << "%"
+            << std::endl;
+  std::cout << "max band error:       " << maxError / cellSize << " cells ("
+            << checked << " samples)" << std::endl;
+  return 0;
+}
+
+// InclusiveScan/ExclusiveScan against std::inclusive_scan on the same data
+int RunScan(const Options &opt) {
+  using Clock = std::chrono::high_resolution_clock;
+
+  const size_t length = opt.scanLength;
+  const int repeats = 20;
+  std::vector<uint32_t> in(length), out(length), reference(length);
+  for (size_t i = 0; i < length; ++i) {
+    in[i] = (uint32_t)(i * 2654435761u) >> 28;
+  }
+  TaskPool pool(opt.threads);
+
+  auto measure = [&](auto &&scan) {
+    scan();
+    auto start = Clock::now();
+    for (int r = 0; r < repeats; ++r) {
+      scan();
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+               .count() /
+           repeats;
+  };
+
+  double stdMs = measure([&]() {
+    std::inclusive_scan(in.begin(), in.end(), reference.begin());
+  });
+  double inclusiveMs =
+      measure([&]() { InclusiveScan(in.data(), out.data(), length, pool); });
+  bool match = out == reference;
+  double exclusiveMs =
+      measure([&]() { ExclusiveScan(in.data(), out.data(), length, pool); });
+  for (size_t i = 0; i < length && match; ++i) {
+    match = out[i] == (i > 0 ? reference[i - 1] : 0);
+  }
+
+  double gb = 2.0 * length * sizeof(uint32_t) / 1e6;
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "scan length:          " << length << std::endl;
+  std::cout << "threads:              " << pool.GetThreadsNum() << std::endl;
+  std::cout << "std::inclusive_scan:  " << stdMs << " ms (" << gb / stdMs
+            << " GB/s)" << std::endl;
+  std::cout << "InclusiveScan:        " << inclusiveMs << " ms ("
+            << gb / inclusiveMs << " GB/s)" << std::endl;
+  std::cout << "ExclusiveScan:        " << exclusiveMs << " ms ("
+            << gb / exclusiveMs << " GB/s)" << std::endl;
+  std::cout << "matches std:          " << (match ? "yes" : "NO") << std::endl;
+  return match ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!ParseOptions(argc, argv, opt)) {
+    PrintUsage();
+    return 1;
+  }
+  if (opt.scanLength > 0) {
+    return RunScan(opt);
+  }
+  if (!opt.voxelizePath.empty()) {
+    return RunVoxelize(opt);
+  }
+
+  const Scenario *scenario = nullptr;
+  for (auto &s : SCENARIOS) {
+    if (opt.scenario == s.name) {
+      scenario = &s;
+    }
+  }
+  if (scenario == nullptr) {
+    std::cerr << "Unknown scenario: " << opt.scenario << std::endl;
+    PrintUsage();
+    return 1;
+  }
+
+  Settings settings;
+  settings.initCube = opt.customCube ? opt.cube : scenario->initCube;
+  settings.initLocalPos = scenario->initLocalPos;
+  settings.threadsNum = opt.threads;
+  settings.neighbourSkin = opt.skin;
+  settings.denseCells = opt.denseCells;
+  settings.halfShellForces = !opt.fullForces;
+  settings.reorderInterval = opt.reorderInterval;
+  if (opt.gridUpdate >= 0) {
+    settings.gridUpdateFraction = opt.gridUpdate;
+  }
+  settings.adaptiveTimestep = opt.adaptive;
+  settings.sleepSteps = opt.sleepSteps;
+  settings.resampleInterval = opt.resampleInterval;
+  settings.timeStepLevels = std::max(opt.timeStepLevels, 1u);
+  settings.countFalseCandidates = opt.countCandidates;
+  settings.boundaryParticles = opt.boundaryParticles;
+  settings.periodic = opt.periodic;
+  if (opt.obstacles) {
+    // a box, a sphere and a pillar in the way of the collapsing column
+    const Vector3 &offset = settings.worldOffset;
+    settings.obstacles = {
+        {ObstacleShape::Box, offset + Vector3(5.f, 0.4f, 2.5f),
+         Vector3(0.4f, 0.4f, 1.5f)},
+        {ObstacleShape::Sphere, offset + Vector3(3.f, 0.5f, 6.f),
+         Vector3(0.8f, 0, 0)},
+        {ObstacleShape::Cylinder, offset + Vector3(6.5f, 1.f, 6.5f),
+         Vector3(0.5f, 1.f, 0)},
+    };
+    settings.obstacleRepulsion = opt.obstacleRepulsion;
+  }
+  if (!opt.waveMaker.empty() &&
+      !AddWaveMaker(opt.waveMaker, settings)) {
+    std::cerr << "Unknown wave maker: " << opt.waveMaker << std::endl;
+    return 1;
+  }
+  if (opt.solver == "pbf") {
+    settings.solver = SphSolver::PositionBased;
+  } else if (opt.solver == "iisph") {
+    settings.solver = SphSolver::Implicit;
+  } else if (opt.solver != "wcsph") {
+    std::cerr << "Unknown solver: " << opt.solver << std::endl;
+    return 1;
+  }
+  // constraint iterations of PBF, the iteration cap of IISPH
+  if (opt.iterations > 0) {
+    settings.pbfIterations = opt.iterations;
+    settings.iisphMaxIterations = opt.iterations;
+  }
+  float dt = opt.dt > 0 ? opt.dt : settings.dt;
+
+  if (opt.ranks > 1) {
+#ifdef _WIN32
+    std::cerr << "--ranks needs the socket transport, not on Windows"
+              << std::endl;
+    return 1;
+#else
+    return RunDistributed(settings, opt, dt);
+#endif
+  }
+
+  // reordering is measured against the same run without it
+  RunResult reference;
+  if (settings.reorderInterval > 0) {
+    Settings unordered = settings;
+    unordered.reorderInterval = 0;
+    reference = Run(unordered, opt.steps, dt);
+  }
+
+  RunResult result = Run(settings, opt.steps, dt);
+  const SphStats &sum = result.sum;
+  const size_t particlesNum = result.particlesNum;
+
+  double steps = std::max(opt.steps, 1u);
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "scenario:             " << scenario->name << std::endl;
+  std::cout << "particles:            " << particlesNum << std::endl;
+  std::cout << "threads:              " << result.threadsNum << std::endl;
+  std::cout << "simd:                 " << SimdPathName() << std::endl;
+  std::cout << "solver:               " << opt.solver << std::endl;
+  std::cout << "cells:                " << (opt.denseCells ? "dense" : "hashed")
+            << (opt.periodic ? ", periodic x/z" : "") << std::endl;
+  std::cout << "forces:               "
+            << (opt.fullForces ? "full neighbourhood" : "half shell")
+            << std::endl;
+  std::cout << "steps:                " << opt.steps << " (dt " << dt << ")"
+            << std::endl;
+  std::cout << "init ms:              " << result.initMs << std::endl;
+  std::cout << "total sec:            " << result.totalSec << std::endl;
+  std::cout << "particle-steps/sec:   "
+            << particlesNum * (double)opt.steps / result.totalSec << std::endl;
+  std::cout << "hash ms/step:         " << sum.hashTime / steps << std::endl;
+  std::cout << "density ms/step:      " << sum.densityTime / steps
+            << std::endl;
+  std::cout << "forces ms/step:       " << sum.forcesTime / steps << std::endl;
+  std::cout << "positions ms/step:    " << sum.positionsTime / steps
+            << std::endl;
+  if (settings.adaptiveTimestep || settings.timeStepLevels > 1) {
+    std::cout << "substeps/step:        " << sum.substeps / steps << std::endl;
+    std::cout << "min substep dt:       " << sum.dt << std::endl;
+  }
+  if (settings.solver == SphSolver::Implicit) {
+    std::cout << "pressure iters/step:  " << sum.pressureIterations / steps
+              << std::endl;
+    std::cout << "density error:        " << 100 * sum.densityError << "%"
+              << std::endl;
+  }
+  if (settings.sleepSteps > 0 || settings.timeStepLevels > 1) {
+    double evaluated = std::max<double>(sum.substeps, 1) * particlesNum;
+    std::cout << "active fraction:      "
+              << 100.0 * sum.activeParticles / evaluated << "%" << std::endl;
+  }
+  if (settings.resampleInterval > 0) {
+    std::cout << "initial particles:    " << result.initialParticlesNum
+              << std::endl;
+    std::cout << "merged/split:         " << sum.merged << " / " << sum.split
+              << std::endl;
+  }
+  if (!settings.kinematicBodies.empty()) {
+    std::cout << "wave maker:           " << opt.waveMaker << std::endl;
+  }
+  if (settings.boundaryParticles) {
+    std::cout << "boundary particles:   " << result.boundaryParticlesNum
+              << std::endl;
+  }
+  std::cout << "incremental grids:    " << sum.gridUpdates << std::endl;
+  if (settings.neighbourSkin > 0) {
+    std::cout << "neighbour list builds: " << sum.neighbourListBuilds
+              << std::endl;
+  }
+  if (opt.countCandidates) {
+    double candidates = std::max<uint64_t>(sum.candidates, 1);
+    std::cout << "candidates/search:    "
+              << sum.candidates /
+                     (double)std::max<uint64_t>(sum.candidateSearches, 1)
+              << std::endl;
+    std::cout << "false candidates:     " << sum.falseCandidates << " ("
+              << 100.0 * sum.falseCandidates / candidates << "%)" << std::endl;
+  }
+  if (result.cacheMisses >= 0) {
+    std::cout << "cache misses/step:    " << result.cacheMisses / steps
+              << std::endl;
+  } else {
+    std::cout << "cache misses/step:    n/a" << std::endl;
+  }
+  if (settings.reorderInterval > 0) {
+    std::cout << "reorder every:        " << settings.reorderInterval
+              << " steps" << std::endl;
+    std::cout << "without reorder sec:  " << reference.totalSec << std::endl;
+    if (result.cacheMisses >= 0 && reference.cacheMisses > 0) {
+      std::cout << "cache miss reduction: "
+                << 100.0 * (1.0 - (double)result.cacheMisses /
+                                      reference.cacheMisses)
+                << "%" << std::endl;
+    }
+  }
+  std::cout << "peak RSS MB:          " << PeakRssMb() << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "cell-grid.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "task-pool.h"
+
+namespace {
+const size_t GRAIN = 4096;
+const size_t CLEAR_GRAIN = 1 << 16;
+// tables this many times larger than the particle count are built sparse
+const size_t SORT_RATIO = 32;
+} // namespace
+
+void CellGrid::AdvanceEpoch(TaskPool &pool) {
+  if (++m_epoch >> (32 - EPOCH_SHIFT) == 0) {
+    return;
+  }
+  // the epoch wrapped, slots of the old ones must not look current
+  pool.ParallelFor(0, m_cells.size(), CLEAR_GRAIN,
+                   [&](size_t begin, size_t end) {
+                     std::fill(m_cells.begin() + begin, m_cells.begin() + end,
+                               0);
+                   });
+  m_epoch = 1;
+}
+
+void CellGrid::Build(const std::vector<uint32_t> &keys, uint32_t tableSize,
+                     TaskPool &pool) {
+  if (m_cells.size() < tableSize) {
+    m_cells.resize(tableSize, 0);
+    m_cellStart.resize(tableSize);
+  }
+  m_entries.resize(keys.size());
+
+  // a crowded table is cheaper to stamp and scan as a whole than to sort the
+  // occupied keys of
+  const bool sparse = keys.size() * SORT_RATIO < tableSize;
+  AdvanceEpoch(pool);
+  const uint32_t epoch = m_epoch << EPOCH_SHIFT;
+  if (!sparse) {
+    // every slot becomes an empty cell of this epoch
+    pool.ParallelFor(0, m_cells.size(), CLEAR_GRAIN,
+                     [&](size_t begin, size_t end) {
+                       std::fill(m_cells.begin() + begin,
+                                 m_cells.begin() + end, epoch);
+                     });
+  }
+
+  if (!sparse) {
+    pool.ParallelFor(0, keys.size(), GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        std::atomic_ref<uint32_t>(m_cells[keys[i]])
+            .fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+
+    // inclusive prefix sum, m_cellStart[key] is the end of the cell for now
+    uint32_t offset = 0;
+    for (uint32_t key = 0; key < tableSize; ++key) {
+      offset += m_cells[key] & COUNT_MASK;
+      m_cellStart[key] = offset;
+    }
+  } else {
+    // the first particle of a stale cell restarts it and records its key
+    m_occupied.resize(keys.size());
+    std::atomic<uint32_t> occupiedNum = 0;
+    pool.ParallelFor(0, keys.size(), GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        std::atomic_ref<uint32_t> cell(m_cells[keys[i]]);
+        uint32_t value = cell.load(std::memory_order_relaxed);
+        uint32_t next;
+        do {
+          next = (value & ~COUNT_MASK) == epoch ? value + 1 : epoch | 1;
+        } while (!cell.compare_exchange_weak(value, next,
+                                             std::memory_order_relaxed));
+        if (next == (epoch | 1)) {
+          m_occupied[occupiedNum.fetch_add(1, std::memory_order_relaxed)] =
+              keys[i];
+        }
+      }
+    });
+
+    // the same sum over the occupied cells only, in key order
+    m_sort.Sort(m_occupied.data(), occupiedNum, tableSize - 1, pool);
+    m_occupied.assign(m_sort.Keys().begin(), m_sort.Keys().end());
+    uint32_t offset = 0;
+    for (uint32_t key : m_occupied) {
+      offset += m_cells[key] & COUNT_MASK;
+      m_cellStart[key] = offset;
+    }
+  }
+
+  // fill the cells back to front, which leaves m_cellStart[key] at the start
+  // of the cell
+  pool.ParallelFor(0, keys.size(), GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = end; i-- > begin;) {
+      uint32_t slot = std::atomic_ref<uint32_t>(m_cellStart[keys[i]])
+                          .fetch_sub(1, std::memory_order_relaxed);
+      m_entries[slot - 1] = i;
+    }
+  });
+
+  m_keys = keys;
+  m_tableSize = tableSize;
+}
+
+bool CellGrid::Update(const std::vector<uint32_t> &keys, uint32_t tableSize,
+                      float maxChanged, TaskPool &pool) {
+  const size_t particlesNum = keys.size();
+  if (m_keys.size() != particlesNum || m_tableSize != tableSize) {
+    Build(keys, tableSize, pool);
+    return false;
+  }
+
+  m_chunkChanged.resize((particlesNum + GRAIN - 1) / GRAIN);
+  pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    uint32_t changed = 0;
+    for (size_t i = begin; i < end; ++i) {
+      changed += keys[i] != m_keys[i];
+    }
+    m_chunkChanged[begin / GRAIN] = changed;
+  });
+  size_t changed = 0;
+  for (uint32_t c : m_chunkChanged) {
+    changed += c;
+  }
+  if (changed > maxChanged * particlesNum) {
+    Build(keys, tableSize, pool);
+    return false;
+  }
+
+  // the particles that kept their key are still in key order, the stable
+  // sort keeps the others of the same key in their old order
+  m_kept.clear();
+  m_moved.clear();
+  m_movedKeys.clear();
+  for (uint32_t i : m_entries) {
+    if (keys[i] == m_keys[i]) {
+      m_kept.push_back(i);
+    } else {
+      m_moved.push_back(i);
+      m_movedKeys.push_back(keys[i]);
+    }
+  }
+  m_sort.Sort(m_movedKeys.data(), m_movedKeys.size(), tableSize - 1, pool);
+  const auto &order = m_sort.Order();
+
+  size_t moved = 0;
+  size_t slot = 0;
+  for (uint32_t i : m_kept) {
+    for (; moved < order.size() && keys[m_moved[order[moved]]] < keys[i];
+         ++moved) {
+      m_entries[slot++] = m_moved[order[moved]];
+    }
+    m_entries[slot++] = i;
+  }
+  for (; moved < order.size(); ++moved) {
+    m_entries[slot++] = m_moved[order[moved]];
+  }
+
+  // only the cells present now get the new epoch
+  AdvanceEpoch(pool);
+  const uint32_t epoch = m_epoch << EPOCH_SHIFT;
+  for (size_t begin = 0; begin < particlesNum;) {
+    uint32_t key = keys[m_entries[begin]];
+    size_t end = begin + 1;
+    while (end < particlesNum && keys[m_entries[end]] == key) {
+      ++end;
+    }
+    m_cellStart[key] = begin;
+    m_cells[key] = epoch | (uint32_t)(end - begin);
+    begin = end;
+  }
+
+  m_keys = keys;
+  return true;
+}
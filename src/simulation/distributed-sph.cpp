@@ -0,0 +1,215 @@
+#include "distributed-sph.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "sph-internal.h"
+
+namespace {
+Settings SlabSettings(const Settings &settings) {
+  Settings slab = settings;
+  slab.reorderInterval = 0;
+  slab.resampleInterval = 0;
+  return slab;
+}
+
+// the number of migrants, the migrants and the ghosts, Particle is plain data
+void Pack(const std::vector<Particle> &migrants,
+          const std::vector<Particle> &ghosts, std::vector<uint8_t> &message) {
+  const uint64_t migrantsNum = migrants.size();
+  const size_t migrantsSize = migrants.size() * sizeof(Particle);
+  message.resize(sizeof(migrantsNum) + migrantsSize +
+                 ghosts.size() * sizeof(Particle));
+  uint8_t *out = message.data();
+  memcpy(out, &migrantsNum, sizeof(migrantsNum));
+  out += sizeof(migrantsNum);
+  if (!migrants.empty()) {
+    memcpy(out, migrants.data(), migrantsSize);
+  }
+  if (!ghosts.empty()) {
+    memcpy(out + migrantsSize, ghosts.data(), ghosts.size() * sizeof(Particle));
+  }
+}
+
+// appends the migrants of a message to `owned` and its ghosts to `local`
+size_t Unpack(const std::vector<uint8_t> &message,
+              std::vector<Particle> &owned, std::vector<Particle> &local) {
+  uint64_t migrantsNum = 0;
+  if (message.size() < sizeof(migrantsNum) ||
+      (message.size() - sizeof(migrantsNum)) % sizeof(Particle) != 0) {
+    throw std::runtime_error("Malformed halo message");
+  }
+  memcpy(&migrantsNum, message.data(), sizeof(migrantsNum));
+  const size_t particlesNum =
+      (message.size() - sizeof(migrantsNum)) / sizeof(Particle);
+  if (migrantsNum > particlesNum) {
+    throw std::runtime_error("Malformed halo message");
+  }
+
+  const uint8_t *in = message.data() + sizeof(migrantsNum);
+  size_t begin = owned.size();
+  owned.resize(begin + migrantsNum);
+  memcpy(owned.data() + begin, in, migrantsNum * sizeof(Particle));
+  in += migrantsNum * sizeof(Particle);
+  begin = local.size();
+  local.resize(begin + particlesNum - migrantsNum);
+  memcpy(local.data() + begin, in,
+         (particlesNum - migrantsNum) * sizeof(Particle));
+  return migrantsNum;
+}
+} // namespace
+
+DistributedSph::DistributedSph(const Settings &settings, Transport &transport)
+    : m_settings(SlabSettings(settings)), m_transport(transport),
+      m_sph(m_settings) {
+  m_halo = m_settings.haloSupports * m_sph.GetSupportRadius();
+}
+
+void DistributedSph::Init(std::vector<Particle> &particles) {
+  m_sph.Init(particles);
+  Cut(particles);
+
+  const uint32_t rank = m_transport.GetRank();
+  const float offset = m_settings.worldOffset.x;
+  std::erase_if(particles, [&](const Particle &p) {
+    return Owner(p.position.x - offset) != rank;
+  });
+}
+
+// Cuts at the quantiles of the initial x, moved up where a slab would be
+// narrower than the halo: the ghosts of a slab have to come from its direct
+// neighbours. The walls of a closed box stay with the first and last slab.
+void DistributedSph::Cut(const std::vector<Particle> &particles) {
+  const uint32_t size = m_transport.GetSize();
+  const uint32_t rank = m_transport.GetRank();
+  const float length = m_settings.boundaryLen.x;
+  const float offset = m_settings.worldOffset.x;
+
+  std::vector<float> xs(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    xs[i] = particles[i].position.x - offset;
+  }
+  std::sort(xs.begin(), xs.end());
+
+  m_cuts.clear();
+  float previous = 0;
+  for (uint32_t r = 1; r < size; ++r) {
+    float quantile = xs.empty() ? r * length / size
+                                : xs[r * xs.size() / size];
+    previous = std::max(quantile, previous + m_halo);
+    m_cuts.push_back(previous);
+  }
+  if (previous + m_halo > length && size > 1) {
+    throw std::runtime_error(
+        std::to_string(size) + " slabs along x can't all be " +
+        std::to_string(m_halo) + " wide, the halo, use fewer ranks");
+  }
+  m_slabBegin = rank > 0 ? m_cuts[rank - 1] : 0;
+  m_slabEnd = rank + 1 < size ? m_cuts[rank] : length;
+
+  // with two ranks on a periodic box both sides lead to the same one
+  m_peers.clear();
+  m_left = -1;
+  m_right = -1;
+  if (size == 1) {
+    return;
+  }
+  if (rank > 0 || m_settings.periodic) {
+    m_peers.push_back((rank + size - 1) % size);
+    m_left = 0;
+  }
+  if (rank + 1 < size || m_settings.periodic) {
+    uint32_t right = (rank + 1) % size;
+    if (m_left >= 0 && m_peers[m_left] == right) {
+      m_right = m_left;
+    } else {
+      m_right = (int)m_peers.size();
+      m_peers.push_back(right);
+    }
+  }
+  m_migrants.resize(m_peers.size());
+  m_ghosts.resize(m_peers.size());
+  m_outgoing.resize(m_peers.size());
+}
+
+uint32_t DistributedSph::Owner(float x) const {
+  return (uint32_t)(std::upper_bound(m_cuts.begin(), m_cuts.end(), x) -
+                    m_cuts.begin());
+}
+
+// around a periodic box the shorter way
+int DistributedSph::Towards(uint32_t owner) const {
+  const uint32_t size = m_transport.GetSize();
+  const uint32_t rank = m_transport.GetRank();
+  if (m_settings.periodic) {
+    return (owner + size - rank) % size <= size / 2 ? m_right : m_left;
+  }
+  return owner < rank ? m_left : m_right;
+}
+
+void DistributedSph::Update(float dt, std::vector<Particle> &particles) {
+  if (m_peers.empty()) {
+    m_stats = DistributedStats();
+    m_sph.Update(dt, particles);
+    return;
+  }
+
+  Exchange(particles);
+  m_sph.ParticlesChanged();
+  m_sph.Update(dt, m_local);
+  particles.assign(m_local.begin(), m_local.begin() + particles.size());
+}
+
+// The particles that left the slab go to the neighbour towards their owner
+// and stay here as ghosts for this step, they are still close. The others
+// near a side of the slab are copied to the neighbour there, once per rank.
+void DistributedSph::Exchange(std::vector<Particle> &particles) {
+  auto start = Clock::now();
+  m_stats = DistributedStats();
+  const uint32_t rank = m_transport.GetRank();
+  const float offset = m_settings.worldOffset.x;
+  for (size_t i = 0; i < m_peers.size(); ++i) {
+    m_migrants[i].clear();
+    m_ghosts[i].clear();
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < particles.size(); ++i) {
+    const Particle &p = particles[i];
+    const float x = p.position.x - offset;
+    const uint32_t owner = Owner(x);
+    if (owner != rank) {
+      m_migrants[Towards(owner)].push_back(p);
+      continue;
+    }
+
+    const bool left = m_left >= 0 && x - m_slabBegin < m_halo;
+    const bool right = m_right >= 0 && m_slabEnd - x < m_halo;
+    if (left) {
+      m_ghosts[m_left].push_back(p);
+    }
+    if (right && !(left && m_right == m_left)) {
+      m_ghosts[m_right].push_back(p);
+    }
+    particles[kept++] = p;
+  }
+  particles.resize(kept);
+
+  for (size_t i = 0; i < m_peers.size(); ++i) {
+    Pack(m_migrants[i], m_ghosts[i], m_outgoing[i]);
+    m_stats.sent += m_migrants[i].size();
+  }
+  m_transport.Exchange(m_peers, m_outgoing, m_incoming);
+
+  m_local.clear();
+  for (size_t i = 0; i < m_peers.size(); ++i) {
+    m_stats.received += Unpack(m_incoming[i], particles, m_local);
+    m_local.insert(m_local.end(), m_migrants[i].begin(), m_migrants[i].end());
+  }
+  m_stats.ghosts = m_local.size();
+  m_local.insert(m_local.begin(), particles.begin(), particles.end());
+  m_stats.exchangeTime = ElapsedMs(start);
+}
@@ -1,6 +1,8 @@
-#include "pch.h"
 #include "heightfield.h"
 
+#include <algorithm>
+#include <cmath>
+
 HeightField::HeightField(const Props& props) {
   m_props = props;
 
@@ -86,7 +88,7 @@ void HeightField::Update(float dt) {
 }
 
 void HeightField::GetRenderData(std::vector<Vector3>& vertecies,
-                                std::vector<UINT16>& indecies) {
+                                std::vector<uint16_t>& indecies) {
   auto& offset = m_props.pos;
   auto& w = m_props.w;
   vertecies.clear();
@@ -110,10 +112,10 @@ void HeightField::GetRenderData(std::vector<Vector3>& vertecies,
         .         .
         bl        br */
 
-      UINT bl = i * m_numZ + j;
-      UINT ul = bl + 1;
-      UINT br = bl + m_numZ;
-      UINT ur = br + 1;
+      uint32_t bl = i * m_numZ + j;
+      uint32_t ul = bl + 1;
+      uint32_t br = bl + m_numZ;
+      uint32_t ur = br + 1;
       indecies.push_back(bl);
       indecies.push_back(br);
       indecies.push_back(ul);
@@ -0,0 +1,120 @@
+#include "kinematic-body.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// v rotated about the unit axis k (Rodrigues)
+Vector3 Rotate(const Vector3 &v, const Vector3 &k, float cos, float sin) {
+  return cos * v + sin * k.Cross(v) + (1 - cos) * k.Dot(v) * k;
+}
+
+// cubic Hermite segment between p0 and p1 with the slopes m0 and m1 (per
+// second) over `duration`, s in [0, 1]; writes the value and its rate
+template <typename T>
+void Hermite(const T &p0, const T &m0, const T &p1, const T &m1,
+             float duration, float s, T &value, T &rate) {
+  float s2 = s * s;
+  float s3 = s2 * s;
+  value = (2 * s3 - 3 * s2 + 1) * p0 + (s3 - 2 * s2 + s) * duration * m0 +
+          (3 * s2 - 2 * s3) * p1 + (s3 - s2) * duration * m1;
+  rate = ((6 * s2 - 6 * s) * p0 + (3 * s2 - 4 * s + 1) * duration * m0 +
+          (6 * s - 6 * s2) * p1 + (3 * s2 - 2 * s) * duration * m1) /
+         duration;
+}
+
+// Catmull-Rom slopes of keyframe k, a looping script wraps to the keyframes
+// one period before and after, the ends of the others are at rest
+void Slopes(const KinematicBody &body, size_t k, Vector3 &position,
+            float &angle) {
+  const auto &frames = body.keyframes;
+  const size_t last = frames.size() - 1;
+  position = Vector3::Zero;
+  angle = 0;
+  const bool loop = body.period > 0 && last > 0;
+  if ((k == 0 || k == last) && !loop) {
+    return;
+  }
+
+  Keyframe prev = frames[k > 0 ? k - 1 : last - 1];
+  Keyframe next = frames[k < last ? k + 1 : 1];
+  if (k == 0) {
+    prev.time -= body.period;
+  }
+  if (k == last) {
+    next.time += body.period;
+  }
+  float duration = next.time - prev.time;
+  if (duration <= 0) {
+    return;
+  }
+  position = (next.position - prev.position) / duration;
+  angle = (next.angle - prev.angle) / duration;
+}
+} // namespace
+
+Vector3 KinematicPose::ToLocal(const Vector3 &p) const {
+  return Rotate(p - position, axis, cos, -sin);
+}
+
+Vector3 KinematicPose::ToWorld(const Vector3 &direction) const {
+  return Rotate(direction, axis, cos, sin);
+}
+
+Vector3 KinematicPose::VelocityAt(const Vector3 &p) const {
+  return velocity + angularVelocity * axis.Cross(p - position);
+}
+
+KinematicPose EvaluatePose(const KinematicBody &body, float time) {
+  KinematicPose pose;
+  if (body.axis.LengthSquared() > 0) {
+    pose.axis = body.axis;
+    pose.axis.Normalize();
+  }
+  const auto &frames = body.keyframes;
+  if (frames.empty()) {
+    return pose;
+  }
+
+  const float first = frames.front().time;
+  float t = time;
+  if (body.period > 0 && t > first) {
+    t = first + std::fmod(t - first, body.period);
+  }
+
+  // the first keyframe later than t ends the segment
+  auto end = std::upper_bound(
+      frames.begin(), frames.end(), t,
+      [](float t, const Keyframe &frame) { return t < frame.time; });
+  if (end == frames.begin() || end == frames.end()) {
+    const Keyframe &rest = end == frames.begin() ? frames.front()
+                                                 : frames.back();
+    pose.position = rest.position;
+    pose.angle = rest.angle;
+  } else {
+    const size_t k = end - frames.begin();
+    const Keyframe &a = frames[k - 1];
+    const Keyframe &b = frames[k];
+    const float duration = b.time - a.time;
+    const float s = (t - a.time) / duration;
+    if (body.smooth) {
+      Vector3 slope0, slope1;
+      float angleSlope0, angleSlope1;
+      Slopes(body, k - 1, slope0, angleSlope0);
+      Slopes(body, k, slope1, angleSlope1);
+      Hermite(a.position, slope0, b.position, slope1, duration, s,
+              pose.position, pose.velocity);
+      Hermite(a.angle, angleSlope0, b.angle, angleSlope1, duration, s,
+              pose.angle, pose.angularVelocity);
+    } else {
+      pose.position = a.position + s * (b.position - a.position);
+      pose.velocity = (b.position - a.position) / duration;
+      pose.angle = a.angle + s * (b.angle - a.angle);
+      pose.angularVelocity = (b.angle - a.angle) / duration;
+    }
+  }
+
+  pose.cos = std::cos(pose.angle);
+  pose.sin = std::sin(pose.angle);
+  return pose;
+}
@@ -1,5 +1,7 @@
 #include "marching-cubes.h"
 
+#include <cassert>
+#include <cmath>
 #include <vector>
 
 #include "SimpleMath.h"
@@ -79,7 +81,7 @@ void MarchingCube::march_cube(XMINT3 pos, std::vector<Vector3> &vertex) {
   }
 }
 
-Vector3 MarchingCube::get_point(UINT edge_index, XMINT3 pos) {
+Vector3 MarchingCube::get_point(uint32_t edge_index, XMINT3 pos) {
   auto point_indecies = EDGES_TABLE[edge_index];
   XMINT3 p1 = POINTS_TABLE[point_indecies[0]];
   XMINT3 p2 = POINTS_TABLE[point_indecies[1]];
@@ -94,7 +96,8 @@ Vector3 MarchingCube::get_point(UINT edge_index, XMINT3 pos) {
   return (worldP1 + worldP2) / 2;
 }
 
-const int *MarchingCube::get_triangulations(UINT x, UINT y, UINT z) {
+const int *MarchingCube::get_triangulations(uint32_t x, uint32_t y,
+                                            uint32_t z) {
   /*
 
   indecies:
@@ -108,15 +111,15 @@ const int *MarchingCube::get_triangulations(UINT x, UINT y, UINT z) {
 
   */
 
-  UINT idx = 0;
-  idx |= (UINT)(!m_voxel_grid.get(x, y, z)) << 0;
-  idx |= (UINT)(!m_voxel_grid.get(x, y, z + 1)) << 1;
-  idx |= (UINT)(!m_voxel_grid.get(x + 1, y, z + 1)) << 2;
-  idx |= (UINT)(!m_voxel_grid.get(x + 1, y, z)) << 3;
-  idx |= (UINT)(!m_voxel_grid.get(x, y + 1, z)) << 4;
-  idx |= (UINT)(!m_voxel_grid.get(x, y + 1, z + 1)) << 5;
-  idx |= (UINT)(!m_voxel_grid.get(x + 1, y + 1, z + 1)) << 6;
-  idx |= (UINT)(!m_voxel_grid.get(x + 1, y + 1, z)) << 7;
+  uint32_t idx = 0;
+  idx |= (uint32_t)(!m_voxel_grid.get(x, y, z)) << 0;
+  idx |= (uint32_t)(!m_voxel_grid.get(x, y, z + 1)) << 1;
+  idx |= (uint32_t)(!m_voxel_grid.get(x + 1, y, z + 1)) << 2;
+  idx |= (uint32_t)(!m_voxel_grid.get(x + 1, y, z)) << 3;
+  idx |= (uint32_t)(!m_voxel_grid.get(x, y + 1, z)) << 4;
+  idx |= (uint32_t)(!m_voxel_grid.get(x, y + 1, z + 1)) << 5;
+  idx |= (uint32_t)(!m_voxel_grid.get(x + 1, y + 1, z + 1)) << 6;
+  idx |= (uint32_t)(!m_voxel_grid.get(x + 1, y + 1, z)) << 7;
 
   assert(idx < 256);
 
@@ -2,13 +2,29 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "SimpleMath.h"
 #include "particle.h"
 #include "sph.h"
 
+void NeighbourHash::setDenseGrid(const XMINT3 &cellsNum) {
+  m_dense = true;
+  m_cellsNum = cellsNum;
+}
+
+uint32_t NeighbourHash::getTableSize() const {
+  return m_dense ? m_cellsNum.x * m_cellsNum.y * m_cellsNum.z : TABLE_SIZE;
+}
+
 uint32_t NeighbourHash::getHash(const XMINT3 &cell) {
+  if (m_dense) {
+    uint32_t x = std::clamp(cell.x, 0, m_cellsNum.x - 1);
+    uint32_t y = std::clamp(cell.y, 0, m_cellsNum.y - 1);
+    uint32_t z = std::clamp(cell.z, 0, m_cellsNum.z - 1);
+    return x + (y + z * m_cellsNum.y) * m_cellsNum.x;
+  }
   return ((uint32_t)(cell.x * 73856093) ^ (uint32_t)(cell.y * 19349663) ^
           (uint32_t)(cell.z * 83492791)) %
          TABLE_SIZE;
@@ -20,18 +36,43 @@ XMINT3 NeighbourHash::getCell(const Particle &p, float h,
                 (p.position.z - offset.z) / h);
 }
 
+void NeighbourHash::sortParticles(std::vector<Particle> &particles,
+                                  TaskPool &pool) {
+  m_keys.resize(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    m_keys[i] = particles[i].hash;
+  }
+  m_sort.Sort(m_keys.data(), m_keys.size(), getTableSize() - 1, pool);
+
+  const auto &order = m_sort.Order();
+  m_sorted.resize(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    m_sorted[i] = particles[order[i]];
+  }
+  particles.swap(m_sorted);
+}
+
 void NeighbourHash::createTable(const std::vector<Particle> &sortedParticles) {
-  m.resize(TABLE_SIZE);
-  for (size_t i = 0; i < TABLE_SIZE; ++i) {
-    m[i] = NO_PARTICLE;
+  const uint32_t tableSize = getTableSize();
+  if (++m_epoch == 0) {
+    std::fill(m_epochs.begin(), m_epochs.end(), 0);
+    m_epoch = 1;
   }
+  m.resize(tableSize, NO_PARTICLE);
+  m_epochs.resize(tableSize, 0);
 
   uint32_t prevHash = NO_PARTICLE;
   for (size_t i = 0; i < sortedParticles.size(); ++i) {
     uint32_t currentHash = sortedParticles[i].hash;
     if (currentHash != prevHash) {
       m[currentHash] = i;
+      m_epochs[currentHash] = m_epoch;
       prevHash = currentHash;
     }
   }
 }
+
+uint32_t NeighbourHash::getFirst(uint32_t hash) const {
+  return hash < m_epochs.size() && m_epochs[hash] == m_epoch ? m[hash]
+                                                               : NO_PARTICLE;
+}
@@ -0,0 +1,83 @@
+#include "neighbour-list.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "periodic.h"
+#include "scan.h"
+
+namespace {
+const size_t GRAIN = 256;
+} // namespace
+
+void NeighbourList::Build(const ParticleSoA &soa, float radius, float skin,
+                          const Vector3 &period, const CandidateFn &candidates,
+                          TaskPool &pool) {
+  const size_t particlesNum = soa.Size();
+  const float cutoff = radius + skin;
+  const float cutoff2 = cutoff * cutoff;
+
+  m_skin = skin;
+  m_period = period;
+  m_start.resize(particlesNum + 1);
+  m_buildPositions.resize(particlesNum);
+  m_chunkIndices.resize((particlesNum + GRAIN - 1) / GRAIN);
+
+  // every chunk collects its lists locally, m_start holds the counts for now
+  pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    auto &out = m_chunkIndices[begin / GRAIN];
+    out.clear();
+    std::vector<uint32_t> found;
+    for (size_t i = begin; i < end; ++i) {
+      Vector3 position = soa.Position(i);
+      m_buildPositions[i] = position;
+      candidates(position, cutoff, found);
+
+      uint32_t count = 0;
+      for (auto c : found) {
+        Vector3 r = MinimumImage(position - soa.Position(c), period);
+        if (r.LengthSquared() < cutoff2) {
+          out.push_back(c);
+          count++;
+        }
+      }
+      m_start[i] = count;
+    }
+  });
+
+  uint32_t offset =
+      ExclusiveScan(m_start.data(), m_start.data(), particlesNum, pool);
+  m_start[particlesNum] = offset;
+
+  m_indices.resize(offset);
+  pool.ParallelFor(0, m_chunkIndices.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t chunk = begin; chunk < end; ++chunk) {
+      auto &src = m_chunkIndices[chunk];
+      std::copy(src.begin(), src.end(),
+                m_indices.begin() + m_start[chunk * GRAIN]);
+    }
+  });
+}
+
+bool NeighbourList::NeedsRebuild(const ParticleSoA &soa,
+                                 TaskPool &pool) const {
+  if (m_start.size() != soa.Size() + 1) {
+    return true;
+  }
+
+  const float limit2 = m_skin * m_skin / 4;
+  std::atomic<bool> moved = false;
+  pool.ParallelFor(0, soa.Size(), 4 * GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end && !moved.load(std::memory_order_relaxed);
+         ++i) {
+      Vector3 shift = soa.Position(i) - m_buildPositions[i];
+      if (MinimumImage(shift, m_period).LengthSquared() > limit2) {
+        moved.store(true, std::memory_order_relaxed);
+      }
+    }
+  });
+  return moved;
+}
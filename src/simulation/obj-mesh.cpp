@@ -0,0 +1,147 @@
+#include "obj-mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+// bytes per parse task
+const size_t CHUNK_SIZE = 256 * 1024;
+
+// A face corner as written: OBJ indices are 1-based, negative ones count back
+// from the last vertex before the face, which is resolved per chunk first.
+struct Corner {
+  int64_t index;
+  bool local;
+};
+
+struct Chunk {
+  std::vector<Vector3> vertices;
+  std::vector<Corner> corners;
+  size_t vertexOffset = 0;
+  size_t indexOffset = 0;
+};
+
+bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+const char *SkipSpaces(const char *p, const char *end) {
+  while (p < end && IsSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+void ParseChunk(const char *p, const char *end, Chunk &chunk) {
+  std::vector<Corner> polygon;
+  while (p < end) {
+    const char *lineEnd = std::find(p, end, '\n');
+    p = SkipSpaces(p, lineEnd);
+
+    if (lineEnd - p > 2 && p[0] == 'v' && IsSpace(p[1])) {
+      float xyz[3] = {0, 0, 0};
+      const char *c = p + 1;
+      for (float &v : xyz) {
+        c = SkipSpaces(c, lineEnd);
+        c = std::from_chars(c, lineEnd, v).ptr;
+      }
+      chunk.vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+    } else if (lineEnd - p > 2 && p[0] == 'f' && IsSpace(p[1])) {
+      polygon.clear();
+      const char *c = SkipSpaces(p + 1, lineEnd);
+      while (c < lineEnd) {
+        int64_t index = 0;
+        auto [next, error] = std::from_chars(c, lineEnd, index);
+        if (error != std::errc() || index == 0) {
+          break;
+        }
+        if (index > 0) {
+          polygon.push_back({index - 1, false});
+        } else {
+          polygon.push_back({(int64_t)chunk.vertices.size() + index, true});
+        }
+        // texture and normal indices are skipped
+        c = next;
+        while (c < lineEnd && !IsSpace(*c)) {
+          c++;
+        }
+        c = SkipSpaces(c, lineEnd);
+      }
+      for (size_t i = 2; i < polygon.size(); ++i) {
+        chunk.corners.push_back(polygon[0]);
+        chunk.corners.push_back(polygon[i - 1]);
+        chunk.corners.push_back(polygon[i]);
+      }
+    }
+    p = lineEnd + 1;
+  }
+}
+} // namespace
+
+// Chunks start after a line break, so relative indices only need the vertex
+// count of the chunks before theirs.
+void LoadObj(const std::string &path, ObjMesh &mesh, TaskPool &pool) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  std::string text((size_t)file.tellg(), '\0');
+  file.seekg(0);
+  if (!file.read(text.data(), text.size())) {
+    throw std::runtime_error("Failed to read " + path);
+  }
+
+  std::vector<size_t> starts = {0};
+  while (starts.back() + CHUNK_SIZE < text.size()) {
+    size_t next = text.find('\n', starts.back() + CHUNK_SIZE);
+    if (next == std::string::npos) {
+      break;
+    }
+    starts.push_back(next + 1);
+  }
+  starts.push_back(text.size());
+
+  std::vector<Chunk> chunks(starts.size() - 1);
+  pool.ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      ParseChunk(text.data() + starts[i], text.data() + starts[i + 1],
+                 chunks[i]);
+    }
+  });
+
+  size_t verticesNum = 0;
+  size_t indicesNum = 0;
+  for (Chunk &chunk : chunks) {
+    chunk.vertexOffset = verticesNum;
+    chunk.indexOffset = indicesNum;
+    verticesNum += chunk.vertices.size();
+    indicesNum += chunk.corners.size();
+  }
+
+  mesh.vertices.resize(verticesNum);
+  mesh.indices.resize(indicesNum);
+  std::atomic<bool> invalid = false;
+  pool.ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Chunk &chunk = chunks[i];
+      std::copy(chunk.vertices.begin(), chunk.vertices.end(),
+                mesh.vertices.begin() + chunk.vertexOffset);
+      for (size_t c = 0; c < chunk.corners.size(); ++c) {
+        const Corner &corner = chunk.corners[c];
+        int64_t index = corner.index;
+        if (corner.local) {
+          index += chunk.vertexOffset;
+        }
+        if (index < 0 || index >= (int64_t)verticesNum) {
+          invalid.store(true, std::memory_order_relaxed);
+          index = 0;
+        }
+        mesh.indices[chunk.indexOffset + c] = (uint32_t)index;
+      }
+    }
+  });
+  if (invalid) {
+    throw std::runtime_error(path + " refers to missing vertices");
+  }
+}
@@ -0,0 +1,62 @@
+#include "particle-soa.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "particle.h"
+
+void ParticleSoA::Resize(size_t size) {
+  for (auto *v : {&x, &y, &z, &vx, &vy, &vz, &fx, &fy, &fz, &nx, &ny, &nz,
+                  &density, &pressure}) {
+    v->resize(size);
+  }
+  hash.resize(size);
+  neighbours.resize(size);
+}
+
+void ParticleSoA::Set(size_t i, const Particle &p) {
+  x[i] = p.position.x;
+  y[i] = p.position.y;
+  z[i] = p.position.z;
+  vx[i] = p.velocity.x;
+  vy[i] = p.velocity.y;
+  vz[i] = p.velocity.z;
+  fx[i] = p.force.x;
+  fy[i] = p.force.y;
+  fz[i] = p.force.z;
+  nx[i] = p.normal.x;
+  ny[i] = p.normal.y;
+  nz[i] = p.normal.z;
+  density[i] = p.density;
+  pressure[i] = p.pressure;
+  hash[i] = p.hash;
+  neighbours[i] = p.neighbours;
+}
+
+Particle ParticleSoA::Get(size_t i) const {
+  Particle p;
+  p.position = Vector3(x[i], y[i], z[i]);
+  p.velocity = Vector3(vx[i], vy[i], vz[i]);
+  p.force = Vector3(fx[i], fy[i], fz[i]);
+  p.normal = Vector3(nx[i], ny[i], nz[i]);
+  p.density = density[i];
+  p.pressure = pressure[i];
+  p.hash = hash[i];
+  p.neighbours = neighbours[i];
+  return p;
+}
+
+void ParticleSoA::Load(const std::vector<Particle> &particles) {
+  Resize(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    Set(i, particles[i]);
+  }
+}
+
+void ParticleSoA::Store(std::vector<Particle> &particles) const {
+  particles.resize(Size());
+  for (size_t i = 0; i < Size(); ++i) {
+    particles[i] = Get(i);
+  }
+}
@@ -0,0 +1,77 @@
+#include "radix-sort.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#include "task-pool.h"
+
+namespace {
+const uint32_t DIGIT_BITS = 8;
+const uint32_t DIGITS = 1 << DIGIT_BITS;
+// chunks per pass, each owns a histogram of DIGITS counts
+const size_t MIN_CHUNK = 16384;
+const size_t CHUNKS_PER_THREAD = 4;
+const size_t GRAIN = 16384;
+} // namespace
+
+void RadixSort::Sort(const uint32_t *keys, size_t count, uint32_t maxKey,
+                     TaskPool &pool) {
+  m_keys.resize(count);
+  m_keysTmp.resize(count);
+  m_order.resize(count);
+  m_orderTmp.resize(count);
+
+  pool.ParallelFor(0, count, GRAIN, [&](size_t begin, size_t end) {
+    std::copy(keys + begin, keys + end, m_keys.begin() + begin);
+    std::iota(m_order.begin() + begin, m_order.begin() + end,
+              (uint32_t)begin);
+  });
+
+  const size_t chunksNum = std::max<size_t>(
+      1, std::min(pool.GetThreadsNum() * CHUNKS_PER_THREAD,
+                  (count + MIN_CHUNK - 1) / MIN_CHUNK));
+  const size_t chunkSize = (count + chunksNum - 1) / chunksNum;
+  m_offsets.resize(chunksNum * DIGITS);
+
+  for (uint32_t shift = 0; shift < 32 && (maxKey >> shift) != 0;
+       shift += DIGIT_BITS) {
+    pool.ParallelFor(0, chunksNum, 1, [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; ++chunk) {
+        uint32_t *counts = &m_offsets[chunk * DIGITS];
+        std::fill(counts, counts + DIGITS, 0);
+        size_t end = std::min(count, (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i) {
+          counts[(m_keys[i] >> shift) & (DIGITS - 1)]++;
+        }
+      }
+    });
+
+    // digit-major exclusive sum, chunks of the same digit stay in order
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < DIGITS; ++digit) {
+      for (size_t chunk = 0; chunk < chunksNum; ++chunk) {
+        uint32_t &slot = m_offsets[chunk * DIGITS + digit];
+        uint32_t digitCount = slot;
+        slot = offset;
+        offset += digitCount;
+      }
+    }
+
+    pool.ParallelFor(0, chunksNum, 1, [&](size_t first, size_t last) {
+      for (size_t chunk = first; chunk < last; ++chunk) {
+        uint32_t *slots = &m_offsets[chunk * DIGITS];
+        size_t end = std::min(count, (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i) {
+          uint32_t slot = slots[(m_keys[i] >> shift) & (DIGITS - 1)]++;
+          m_keysTmp[slot] = m_keys[i];
+          m_orderTmp[slot] = m_order[i];
+        }
+      }
+    });
+    m_keys.swap(m_keysTmp);
+    m_order.swap(m_orderTmp);
+  }
+}
@@ -0,0 +1,110 @@
+#include "scan.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "task-pool.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCAN_SSE
+#endif
+
+namespace {
+const size_t GRAIN = 1 << 16;
+
+// Scans in[0..count) into out starting from carry, subtracting the input
+// for the exclusive variant; returns the carry after the last element.
+template <bool Exclusive>
+uint32_t ScanChunk(const uint32_t *in, uint32_t *out, size_t count,
+                   uint32_t carry) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256i offset = _mm256_set1_epi32(carry);
+  for (; i + 8 <= count; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+    // prefix inside both 128-bit halves, then the low half's total is added
+    // to the high half
+    __m256i s = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    s = _mm256_add_epi32(s, _mm256_slli_si256(s, 8));
+    __m256i low = _mm256_shuffle_epi32(s, _MM_SHUFFLE(3, 3, 3, 3));
+    s = _mm256_add_epi32(s, _mm256_permute2x128_si256(low, low, 0x08));
+    s = _mm256_add_epi32(s, offset);
+    offset = _mm256_permutevar8x32_epi32(s, _mm256_set1_epi32(7));
+    if (Exclusive) {
+      s = _mm256_sub_epi32(s, x);
+    }
+    _mm256_storeu_si256((__m256i *)(out + i), s);
+  }
+  carry = (uint32_t)_mm256_extract_epi32(offset, 0);
+#elif defined(SCAN_SSE)
+  __m128i offset = _mm_set1_epi32(carry);
+  for (; i + 4 <= count; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i s = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    s = _mm_add_epi32(s, _mm_slli_si128(s, 8));
+    s = _mm_add_epi32(s, offset);
+    offset = _mm_shuffle_epi32(s, _MM_SHUFFLE(3, 3, 3, 3));
+    if (Exclusive) {
+      s = _mm_sub_epi32(s, x);
+    }
+    _mm_storeu_si128((__m128i *)(out + i), s);
+  }
+  carry = (uint32_t)_mm_cvtsi128_si32(offset);
+#endif
+  for (; i < count; ++i) {
+    uint32_t value = in[i];
+    carry += value;
+    out[i] = Exclusive ? carry - value : carry;
+  }
+  return carry;
+}
+
+uint32_t Sum(const uint32_t *in, size_t count) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < count; ++i) {
+    sum += in[i];
+  }
+  return sum;
+}
+
+template <bool Exclusive>
+uint32_t Scan(const uint32_t *in, uint32_t *out, size_t count,
+              TaskPool &pool) {
+  if (count <= GRAIN || pool.GetThreadsNum() == 1) {
+    return ScanChunk<Exclusive>(in, out, count, 0);
+  }
+
+  const size_t chunksNum = (count + GRAIN - 1) / GRAIN;
+  std::vector<uint32_t> offsets(chunksNum);
+  pool.ParallelFor(0, count, GRAIN, [&](size_t begin, size_t end) {
+    offsets[begin / GRAIN] = Sum(in + begin, end - begin);
+  });
+
+  uint32_t total = 0;
+  for (auto &offset : offsets) {
+    uint32_t sum = offset;
+    offset = total;
+    total += sum;
+  }
+
+  pool.ParallelFor(0, count, GRAIN, [&](size_t begin, size_t end) {
+    ScanChunk<Exclusive>(in + begin, out + begin, end - begin,
+                         offsets[begin / GRAIN]);
+  });
+  return total;
+}
+} // namespace
+
+void InclusiveScan(const uint32_t *in, uint32_t *out, size_t count,
+                   TaskPool &pool) {
+  Scan<false>(in, out, count, pool);
+}
+
+uint32_t ExclusiveScan(const uint32_t *in, uint32_t *out, size_t count,
+                       TaskPool &pool) {
+  return Scan<true>(in, out, count, pool);
+}
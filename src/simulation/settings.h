@@ -1,7 +1,56 @@
 #pragma once
 
-#include "SimpleMath.h"
-#include "pch.h"
+#include <DirectXMath.h>
+#include <SimpleMath.h>
+#include <stdint.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+using namespace DirectX::SimpleMath;
+
+// smoothing kernels of the CPU solver, Wendland is the one of the GPU shaders
+enum class SphKernel { Mueller, CubicSpline, Wendland };
+
+// pressure model of the CPU solver: pressure = k * (density - restDensity),
+// the density constraints of Position Based Fluids (Macklin, Mueller 2013) or
+// the pressure projection of IISPH (Ihmsen et al. 2014)
+enum class SphSolver { WeaklyCompressible, PositionBased, Implicit };
+
+// solid obstacle of the CPU solver, size holds the half extents of a box, the
+// radius of a sphere in x, the radius and half height of a y-axis cylinder in
+// x and y, the scale of a closed OBJ mesh in x (placed at center)
+enum class ObstacleShape { Box, Sphere, Cylinder, Mesh };
+struct Obstacle {
+  ObstacleShape shape = ObstacleShape::Box;
+  Vector3 center = Vector3::Zero;
+  Vector3 size = Vector3(1.f, 1.f, 1.f);
+  std::string mesh = "";
+};
+
+// pose of a kinematic body at `time`: the position of its pivot and the
+// rotation (radians) about its axis
+struct Keyframe {
+  float time = 0;
+  Vector3 position = Vector3::Zero;
+  float angle = 0;
+};
+
+// solid moved by a script, a piston, a wave paddle or a stirrer: shape is
+// placed relative to the pivot (its center in pivot space), the keyframes are
+// sorted by time and interpolated linearly or, when smooth, by a cubic
+// through them that eases in and out of the first and last one. Before the
+// first keyframe the body rests on it. With period > 0 the script repeats
+// every period after the first keyframe and should end on its first pose.
+struct KinematicBody {
+  Obstacle shape;
+  Vector3 axis = Vector3(0, 0, 1.f);
+  std::vector<Keyframe> keyframes;
+  float period = 0;
+  bool smooth = true;
+};
 
 struct Settings {
   Vector3 worldOffset = Vector3(-8.f, 0.3f, -8.f);
@@ -20,11 +69,104 @@ struct Settings {
   Vector2 trappedAirThreshold = Vector2(1, 20);
   Vector2 wavecrestThreshold = Vector2(1, 8);
   Vector2 energyThreshold = Vector2(2, 50);
-  UINT blockSize = 1024;
-  UINT diffuseNum = 512 * 1024;
+  uint32_t blockSize = 1024;
+  uint32_t diffuseNum = 512 * 1024;
   bool cpu = false;
+  // worker threads of the CPU solver, 0 - all hardware threads
+  uint32_t threadsNum = 0;
+  // skin of the cached CPU neighbour lists, 0 - search the grid every step
+  float neighbourSkin = 0;
+  // evaluate every particle pair once in the CPU force pass
+  bool halfShellForces = true;
+  SphKernel kernel = SphKernel::Mueller;
+  SphSolver solver = SphSolver::WeaklyCompressible;
+  float restDensity = 1000.f;
+  // Position Based Fluids: constraint iterations per step, constraint force
+  // mixing, XSPH viscosity and the artificial pressure k (tensile instability)
+  uint32_t pbfIterations = 4;
+  float pbfRelaxation = 100.f;
+  float xsphViscosity = 0.01f;
+  float pbfTensileK = 0.1f;
+  // IISPH: relaxed Jacobi iterations until the mean compression is below
+  // iisphMaxError of the rest density
+  uint32_t iisphMinIterations = 2;
+  uint32_t iisphMaxIterations = 100;
+  float iisphMaxError = 0.001f;
+  float iisphOmega = 0.5f;
+  // kernel support of the PBF and IISPH solvers in units of h, Init() spaces
+  // particles 0.9 h apart and both need more than the 6 neighbours within h
+  float incompressibleSupport = 2.f;
+  // CPU cells get a collision-free linear index over the boundary box instead
+  // of the TABLE_SIZE hash
+  bool denseCells = false;
+  // the CPU grid is merged from the last one while at most this fraction of
+  // the particles changed cell, 0 - always a full counting sort
+  float gridUpdateFraction = 0.5f;
+  // steps between Morton reorders of the CPU particle array, 0 - never
+  uint32_t reorderInterval = 0;
+  // the CPU solver splits every Update() into substeps limited by
+  // cflFactor * h / max |v| and forceFactor * sqrt(h / max |a|)
+  bool adaptiveTimestep = false;
+  float cflFactor = 0.4f;
+  float forceFactor = 0.25f;
+  uint32_t maxSubsteps = 32;
+  // multi-rate stepping of the CPU WCSPH solver (1 - off): every Update() is
+  // split into 2^(timeStepLevels - 1) substeps and each particle steps by
+  // dt / 2^level, with the smallest level its own velocity and acceleration
+  // allow under cflFactor and forceFactor. Only particles at a boundary of
+  // their level get new densities and forces, the others drift.
+  uint32_t timeStepLevels = 1;
+  // the CPU WCSPH solver freezes cells whose particles and neighbouring cells
+  // stayed below sleepVelocity and a relative density change of
+  // sleepDensityChange for sleepSteps (at most 255) steps, 0 - never
+  uint32_t sleepSteps = 0;
+  float sleepVelocity = 0.05f;
+  float sleepDensityChange = 0.001f;
+  // CPU WCSPH adaptive resolution, resampled every resampleInterval steps
+  // (0 - never): particles more than surfaceDepth neighbour rings away from
+  // the free surface merge pairwise up to maxMassScale times mass, merged ones
+  // split again closer than surfaceDepth rings. The surface is where the
+  // colour field gradient |sum mass / density grad W| exceeds
+  // surfaceThreshold / h.
+  uint32_t resampleInterval = 0;
+  uint32_t surfaceDepth = 2;
+  float maxMassScale = 2.f;
+  float surfaceThreshold = 0.6f;
+  // obstacles (world space) of the CPU solver, unioned into a signed
+  // distance field sampled every obstacleCellSize around them. Particles
+  // closer than h to a surface are reflected like at the boundary box, or,
+  // with obstacleRepulsion > 0, pushed out by a penalty acceleration of
+  // obstacleRepulsion * penetration and only reflected inside the solid.
+  std::vector<Obstacle> obstacles;
+  float obstacleCellSize = h / 2;
+  float obstacleRepulsion = 0;
+  // CPU WCSPH boundaries as particles with a volume (Akinci et al. 2012),
+  // sampled every boundarySpacing on the floor and side walls of the box and
+  // on the obstacle surfaces. Their density and pressure push the fluid out,
+  // walls and obstacles only clamp what still gets through.
+  bool boundaryParticles = false;
+  float boundarySpacing = h / 2;
+  float boundaryStiffness = 20.f;
+  // kinematic bodies of the CPU solver, posed once per Update() at the end
+  // of the frame; particles closer than h are reflected with the velocity of
+  // the body surface added, so a moving body pushes the fluid
+  std::vector<KinematicBody> kinematicBodies;
+  // the boundary box of the CPU solver repeats along x and z, an ocean tile:
+  // particles leaving it come back on the other side and interact across the
+  // seam, obstacles and kinematic bodies are not repeated. boundaryLen.x and
+  // z must be whole multiples of h.
+  bool periodic = false;
+  // DistributedSph splits the box along x into one slab per rank and copies
+  // the particles within haloSupports support radii of a slab to it as
+  // ghosts. Ghosts right at the edge of the halo miss neighbours, every
+  // substep or pressure iteration spreads that one support further in: 2
+  // keeps a single WCSPH step exact, more substeps or iterations need more.
+  float haloSupports = 2.f;
+  // count the density candidates of non-neighbouring cells (slow)
+  bool countFalseCandidates = false;
   bool diffuseEnabled = false;
   bool marching = true;
   float dt = 1.f / 160.f;
-  UINT TABLE_SIZE = boundaryLen.x * boundaryLen.y * boundaryLen.z / pow(h, 3);
+  uint32_t TABLE_SIZE =
+      boundaryLen.x * boundaryLen.y * boundaryLen.z / pow(h, 3);
 };
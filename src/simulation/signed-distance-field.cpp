@@ -0,0 +1,356 @@
+#include "signed-distance-field.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "sph-internal.h"
+
+namespace {
+// z slices (or y slices of a sweep along z) per task
+const size_t SLICE_GRAIN = 1;
+const size_t TRIANGLE_GRAIN = 64;
+// x rows per task
+const size_t LINE_GRAIN = 64;
+// the sweeps of all six directions run this many times
+const int SWEEP_ROUNDS = 2;
+const uint32_t NO_TRIANGLE = std::numeric_limits<uint32_t>::max();
+// the sign rays pass this far (in cells) off the sample rows, so they don't
+// hit the edges of a mesh that is aligned with the grid
+const float RAY_OFFSET_Y = 1.37e-3f;
+const float RAY_OFFSET_Z = 2.71e-3f;
+
+float Length(float x, float y) { return std::sqrt(x * x + y * y); }
+
+// distances are not negative, so their bits order like the floats
+uint64_t Pack(float distance, uint32_t triangle) {
+  return (uint64_t)std::bit_cast<uint32_t>(distance) << 32 | triangle;
+}
+float UnpackDistance(uint64_t packed) {
+  return std::bit_cast<float>((uint32_t)(packed >> 32));
+}
+uint32_t UnpackTriangle(uint64_t packed) { return (uint32_t)packed; }
+} // namespace
+
+// Real-Time Collision Detection (Ericson), 5.1.5
+Vector3 ClosestOnTriangle(const Vector3 &p, const Vector3 &a,
+                          const Vector3 &b, const Vector3 &c) {
+  Vector3 ab = b - a;
+  Vector3 ac = c - a;
+  Vector3 ap = p - a;
+  float d1 = ab.Dot(ap);
+  float d2 = ac.Dot(ap);
+  if (d1 <= 0 && d2 <= 0) {
+    return a;
+  }
+  Vector3 bp = p - b;
+  float d3 = ab.Dot(bp);
+  float d4 = ac.Dot(bp);
+  if (d3 >= 0 && d4 <= d3) {
+    return b;
+  }
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+    return a + d1 / (d1 - d3) * ab;
+  }
+  Vector3 cp = p - c;
+  float d5 = ab.Dot(cp);
+  float d6 = ac.Dot(cp);
+  if (d6 >= 0 && d5 <= d6) {
+    return c;
+  }
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+    return a + d2 / (d2 - d6) * ac;
+  }
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+    return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);
+  }
+  float denom = 1 / (va + vb + vc);
+  return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+void SignedDistanceField::Reset(const Vector3 &min, const Vector3 &max,
+                                float cellSize) {
+  Vector3 size = max - min;
+  m_origin = min;
+  m_cellSize = cellSize;
+  m_samplesNum = XMINT3((int)std::ceil(size.x / cellSize) + 1,
+                        (int)std::ceil(size.y / cellSize) + 1,
+                        (int)std::ceil(size.z / cellSize) + 1);
+  // samples start farther than any point of the grid from an obstacle
+  m_far = size.Length() + cellSize;
+  m_values.assign((size_t)m_samplesNum.x * m_samplesNum.y * m_samplesNum.z,
+                  m_far);
+}
+
+template <typename Fn> void SignedDistanceField::Add(Fn &&fn, TaskPool &pool) {
+  const size_t slices = m_samplesNum.z;
+  pool.ParallelFor(0, slices, SLICE_GRAIN, [&](size_t begin, size_t end) {
+    for (size_t z = begin; z < end; ++z) {
+      for (int y = 0; y < m_samplesNum.y; ++y) {
+        size_t row = (y + z * m_samplesNum.y) * m_samplesNum.x;
+        for (int x = 0; x < m_samplesNum.x; ++x) {
+          Vector3 position = m_origin + m_cellSize * Vector3((float)x, (float)y,
+                                                             (float)z);
+          float &value = m_values[row + x];
+          value = std::min(value, fn(position));
+        }
+      }
+    }
+  });
+}
+
+void SignedDistanceField::AddBox(const Vector3 &center,
+                                 const Vector3 &halfExtents, TaskPool &pool) {
+  Add(
+      [&](const Vector3 &position) {
+        Vector3 q = position - center;
+        q = Vector3(std::abs(q.x), std::abs(q.y), std::abs(q.z)) - halfExtents;
+        Vector3 outside = Vector3::Max(q, Vector3::Zero);
+        return outside.Length() + std::min(std::max({q.x, q.y, q.z}), 0.f);
+      },
+      pool);
+}
+
+void SignedDistanceField::AddSphere(const Vector3 &center, float radius,
+                                    TaskPool &pool) {
+  Add([&](const Vector3 &position) {
+    return (position - center).Length() - radius;
+  },
+      pool);
+}
+
+void SignedDistanceField::AddCylinder(const Vector3 &center, float radius,
+                                      float halfHeight, TaskPool &pool) {
+  Add(
+      [&](const Vector3 &position) {
+        Vector3 q = position - center;
+        float radial = Length(q.x, q.z) - radius;
+        float axial = std::abs(q.y) - halfHeight;
+        return Length(std::max(radial, 0.f), std::max(axial, 0.f)) +
+               std::min(std::max(radial, axial), 0.f);
+      },
+      pool);
+}
+
+float SignedDistanceField::Distance(const Vector3 &position) const {
+  Vector3 gradient;
+  return Distance(position, gradient);
+}
+
+float SignedDistanceField::Distance(const Vector3 &position,
+                                    Vector3 &gradient) const {
+  gradient = Vector3::Zero;
+  if (m_values.empty()) {
+    return m_far;
+  }
+
+  Vector3 local = (position - m_origin) / m_cellSize;
+  if (!(local.x >= 0 && local.y >= 0 && local.z >= 0 &&
+        local.x <= m_samplesNum.x - 1 && local.y <= m_samplesNum.y - 1 &&
+        local.z <= m_samplesNum.z - 1)) {
+    return m_far;
+  }
+
+  // the last sample of an axis interpolates within the cell before it
+  int x = std::min((int)local.x, m_samplesNum.x - 2);
+  int y = std::min((int)local.y, m_samplesNum.y - 2);
+  int z = std::min((int)local.z, m_samplesNum.z - 2);
+  float fx = local.x - x;
+  float fy = local.y - y;
+  float fz = local.z - z;
+
+  float c000 = Sample(x, y, z), c100 = Sample(x + 1, y, z);
+  float c010 = Sample(x, y + 1, z), c110 = Sample(x + 1, y + 1, z);
+  float c001 = Sample(x, y, z + 1), c101 = Sample(x + 1, y, z + 1);
+  float c011 = Sample(x, y + 1, z + 1), c111 = Sample(x + 1, y + 1, z + 1);
+
+  // along x, then y, then z
+  float c00 = c000 + fx * (c100 - c000);
+  float c10 = c010 + fx * (c110 - c010);
+  float c01 = c001 + fx * (c101 - c001);
+  float c11 = c011 + fx * (c111 - c011);
+  float c0 = c00 + fy * (c10 - c00);
+  float c1 = c01 + fy * (c11 - c01);
+
+  float dx0 = (c100 - c000) + fy * ((c110 - c010) - (c100 - c000));
+  float dx1 = (c101 - c001) + fy * ((c111 - c011) - (c101 - c001));
+  gradient = Vector3(dx0 + fz * (dx1 - dx0),
+                     (c10 - c00) + fz * ((c11 - c01) - (c10 - c00)), c1 - c0) /
+             m_cellSize;
+  return c0 + fz * (c1 - c0);
+}
+
+SignedDistanceField::MeshStats
+SignedDistanceField::AddMesh(const std::vector<Vector3> &vertices,
+                             const std::vector<uint32_t> &indices,
+                             float bandWidth, TaskPool &pool) {
+  MeshStats stats;
+  const size_t trianglesNum = indices.size() / 3;
+  const XMINT3 &n = m_samplesNum;
+  const size_t samplesNum = m_values.size();
+  auto sample = [&](int x, int y, int z) {
+    return m_origin + m_cellSize * Vector3((float)x, (float)y, (float)z);
+  };
+  auto corner = [&](uint32_t triangle, int c) {
+    return vertices[indices[3 * triangle + c]];
+  };
+  auto distance = [&](const Vector3 &p, uint32_t triangle) {
+    Vector3 a = corner(triangle, 0), b = corner(triangle, 1);
+    return (p - ClosestOnTriangle(p, a, b, corner(triangle, 2))).Length();
+  };
+  // samples of [min, max] (in cells) along an axis, clamped to the grid
+  auto first = [](float min, int samples) {
+    return std::clamp((int)std::ceil(min), 0, samples);
+  };
+  auto last = [](float max, int samples) {
+    return std::clamp((int)std::floor(max), -1, samples - 1);
+  };
+
+  // exact distances in a band around every triangle
+  auto start = Clock::now();
+  m_closest.assign(samplesNum, Pack(m_far, NO_TRIANGLE));
+  m_crossings.assign(samplesNum, 0);
+  pool.ParallelFor(0, trianglesNum, TRIANGLE_GRAIN, [&](size_t begin,
+                                                        size_t end) {
+    for (uint32_t t = (uint32_t)begin; t < end; ++t) {
+      Vector3 a = (corner(t, 0) - m_origin) / m_cellSize;
+      Vector3 b = (corner(t, 1) - m_origin) / m_cellSize;
+      Vector3 c = (corner(t, 2) - m_origin) / m_cellSize;
+      Vector3 min = Vector3::Min(a, Vector3::Min(b, c)) - Vector3(MESH_BAND);
+      Vector3 max = Vector3::Max(a, Vector3::Max(b, c)) + Vector3(MESH_BAND);
+      for (int z = first(min.z, n.z); z <= last(max.z, n.z); ++z) {
+        for (int y = first(min.y, n.y); y <= last(max.y, n.y); ++y) {
+          for (int x = first(min.x, n.x); x <= last(max.x, n.x); ++x) {
+            uint64_t packed = Pack(distance(sample(x, y, z), t), t);
+            std::atomic_ref<uint64_t> closest(m_closest[Index(x, y, z)]);
+            uint64_t current = closest.load(std::memory_order_relaxed);
+            while (packed < current &&
+                   !closest.compare_exchange_weak(current, packed,
+                                                  std::memory_order_relaxed)) {
+            }
+          }
+        }
+      }
+    }
+  });
+  stats.bandTime = ElapsedMs(start);
+
+  // every triangle flips the parity of the first sample past the point
+  // where it crosses the x ray of a sample row
+  start = Clock::now();
+  pool.ParallelFor(0, trianglesNum, TRIANGLE_GRAIN, [&](size_t begin,
+                                                        size_t end) {
+    for (uint32_t t = (uint32_t)begin; t < end; ++t) {
+      Vector3 a = (corner(t, 0) - m_origin) / m_cellSize;
+      Vector3 b = (corner(t, 1) - m_origin) / m_cellSize;
+      Vector3 c = (corner(t, 2) - m_origin) / m_cellSize;
+      float minY = std::min({a.y, b.y, c.y}) - RAY_OFFSET_Y;
+      float maxY = std::max({a.y, b.y, c.y}) - RAY_OFFSET_Y;
+      float minZ = std::min({a.z, b.z, c.z}) - RAY_OFFSET_Z;
+      float maxZ = std::max({a.z, b.z, c.z}) - RAY_OFFSET_Z;
+      for (int z = first(minZ, n.z); z <= last(maxZ, n.z); ++z) {
+        for (int y = first(minY, n.y); y <= last(maxY, n.y); ++y) {
+          float py = y + RAY_OFFSET_Y;
+          float pz = z + RAY_OFFSET_Z;
+          // barycentric coordinates of the ray in the yz projection
+          float wa = (b.y - py) * (c.z - pz) - (b.z - pz) * (c.y - py);
+          float wb = (c.y - py) * (a.z - pz) - (c.z - pz) * (a.y - py);
+          float wc = (a.y - py) * (b.z - pz) - (a.z - pz) * (b.y - py);
+          float area = wa + wb + wc;
+          if (area == 0 || (wa < 0) != (area < 0) || (wb < 0) != (area < 0) ||
+              (wc < 0) != (area < 0)) {
+            continue;
+          }
+          float crossing = (wa * a.x + wb * b.x + wc * c.x) / area;
+          int x = first(crossing, n.x);
+          if (x < n.x) {
+            std::atomic_ref<uint8_t>(m_crossings[Index(x, y, z)])
+                .fetch_xor(1, std::memory_order_relaxed);
+          }
+        }
+      }
+    }
+  });
+  stats.signTime = ElapsedMs(start);
+
+  // Closest triangles spread along each axis in both directions, every
+  // sample checks the one of the sample before it. Sweeps along y and z move
+  // whole x rows at a time, so all of them read memory in order.
+  start = Clock::now();
+  auto relax = [&](size_t s, size_t previous) {
+    uint32_t candidate = UnpackTriangle(m_closest[previous]);
+    // the candidate is at least its distance to the previous sample minus a
+    // cell away, and nothing spreads beyond the band
+    float reach = UnpackDistance(m_closest[previous]);
+    if (candidate == NO_TRIANGLE || reach > bandWidth ||
+        candidate == UnpackTriangle(m_closest[s]) ||
+        reach - m_cellSize >= UnpackDistance(m_closest[s])) {
+      return;
+    }
+    Vector3 position = sample((int)(s % n.x), (int)(s / n.x % n.y),
+                              (int)(s / ((size_t)n.x * n.y)));
+    m_closest[s] =
+        std::min(m_closest[s], Pack(distance(position, candidate), candidate));
+  };
+  // forth and back over `size` x rows from `plane` on, `stride` apart
+  auto sweepRows = [&](size_t plane, int size, size_t stride) {
+    for (int i = 1; i < size; ++i) {
+      size_t row = plane + i * stride;
+      for (int x = 0; x < n.x; ++x) {
+        relax(row + x, row + x - stride);
+      }
+    }
+    for (int i = size - 2; i >= 0; --i) {
+      size_t row = plane + i * stride;
+      for (int x = 0; x < n.x; ++x) {
+        relax(row + x, row + x + stride);
+      }
+    }
+  };
+
+  for (int round = 0; round < SWEEP_ROUNDS; ++round) {
+    pool.ParallelFor(0, (size_t)n.y * n.z, LINE_GRAIN, [&](size_t begin,
+                                                            size_t end) {
+      for (size_t line = begin; line < end; ++line) {
+        size_t row = line * n.x;
+        for (int x = 1; x < n.x; ++x) {
+          relax(row + x, row + x - 1);
+        }
+        for (int x = n.x - 2; x >= 0; --x) {
+          relax(row + x, row + x + 1);
+        }
+      }
+    });
+    pool.ParallelFor(0, n.z, SLICE_GRAIN, [&](size_t begin, size_t end) {
+      for (size_t z = begin; z < end; ++z) {
+        sweepRows(z * n.x * n.y, n.y, n.x);
+      }
+    });
+    pool.ParallelFor(0, n.y, SLICE_GRAIN, [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; ++y) {
+        sweepRows(y * n.x, n.z, (size_t)n.x * n.y);
+      }
+    });
+  }
+
+  pool.ParallelFor(0, (size_t)n.y * n.z, LINE_GRAIN, [&](size_t begin,
+                                                          size_t end) {
+    for (size_t line = begin; line < end; ++line) {
+      bool inside = false;
+      for (size_t s = line * n.x; s < (line + 1) * n.x; ++s) {
+        inside ^= m_crossings[s] != 0;
+        float d = std::min(UnpackDistance(m_closest[s]), bandWidth);
+        if (inside || d < bandWidth) {
+          m_values[s] = std::min(m_values[s], inside ? -d : d);
+        }
+      }
+    }
+  });
+  stats.sweepTime = ElapsedMs(start);
+  return stats;
+}
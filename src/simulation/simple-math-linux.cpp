@@ -0,0 +1,38 @@
+// SimpleMath keeps its static constants in DirectXTK's SimpleMath.cpp, which
+// only builds on Windows. The headless core uses SimpleMath header-only, so
+// the constants are defined here instead.
+#ifndef _WIN32
+
+#include <SimpleMath.h>
+
+namespace DirectX {
+namespace SimpleMath {
+
+const Vector2 Vector2::Zero = {0.f, 0.f};
+const Vector2 Vector2::One = {1.f, 1.f};
+const Vector2 Vector2::UnitX = {1.f, 0.f};
+const Vector2 Vector2::UnitY = {0.f, 1.f};
+
+const Vector3 Vector3::Zero = {0.f, 0.f, 0.f};
+const Vector3 Vector3::One = {1.f, 1.f, 1.f};
+const Vector3 Vector3::UnitX = {1.f, 0.f, 0.f};
+const Vector3 Vector3::UnitY = {0.f, 1.f, 0.f};
+const Vector3 Vector3::UnitZ = {0.f, 0.f, 1.f};
+const Vector3 Vector3::Up = {0.f, 1.f, 0.f};
+const Vector3 Vector3::Down = {0.f, -1.f, 0.f};
+const Vector3 Vector3::Right = {1.f, 0.f, 0.f};
+const Vector3 Vector3::Left = {-1.f, 0.f, 0.f};
+const Vector3 Vector3::Forward = {0.f, 0.f, -1.f};
+const Vector3 Vector3::Backward = {0.f, 0.f, 1.f};
+
+const Vector4 Vector4::Zero = {0.f, 0.f, 0.f, 0.f};
+const Vector4 Vector4::One = {1.f, 1.f, 1.f, 1.f};
+const Vector4 Vector4::UnitX = {1.f, 0.f, 0.f, 0.f};
+const Vector4 Vector4::UnitY = {0.f, 1.f, 0.f, 0.f};
+const Vector4 Vector4::UnitZ = {0.f, 0.f, 1.f, 0.f};
+const Vector4 Vector4::UnitW = {0.f, 0.f, 0.f, 1.f};
+
+} // namespace SimpleMath
+} // namespace DirectX
+
+#endif
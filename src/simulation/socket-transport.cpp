@@ -0,0 +1,203 @@
+// The local backend of Transport, Linux and other POSIX systems only.
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "transport.h"
+
+namespace {
+// every message goes out as its length followed by its bytes
+const size_t HEADER_SIZE = sizeof(uint64_t);
+
+[[noreturn]] void ThrowError(const char *what) {
+  throw std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+void CloseAll(std::vector<int> &sockets) {
+  for (int &fd : sockets) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+}
+
+// the progress of one peer in Exchange(), done at total bytes
+struct Transfer {
+  uint64_t header = 0;
+  size_t done = 0;
+  size_t total = HEADER_SIZE;
+};
+} // namespace
+
+std::unique_ptr<SocketTransport> SocketTransport::Fork(uint32_t size) {
+  if (size == 0) {
+    throw std::runtime_error("A transport needs at least one rank");
+  }
+
+  // sockets[a][b] is the end of rank a towards rank b
+  std::vector<std::vector<int>> sockets(size, std::vector<int>(size, -1));
+  auto closeAll = [&]() {
+    for (auto &row : sockets) {
+      CloseAll(row);
+    }
+  };
+  for (uint32_t a = 0; a < size; ++a) {
+    for (uint32_t b = a + 1; b < size; ++b) {
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        closeAll();
+        ThrowError("socketpair");
+      }
+      sockets[a][b] = pair[0];
+      sockets[b][a] = pair[1];
+      fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+      fcntl(pair[1], F_SETFL, fcntl(pair[1], F_GETFL) | O_NONBLOCK);
+    }
+  }
+
+  // buffered output would be written once more by every child
+  fflush(nullptr);
+  std::vector<int> children;
+  for (uint32_t rank = 1; rank < size; ++rank) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      // the children that did start see their sockets close and fail
+      closeAll();
+      for (int child : children) {
+        waitpid(child, nullptr, 0);
+      }
+      ThrowError("fork");
+    }
+    if (pid == 0) {
+      std::vector<int> own;
+      own.swap(sockets[rank]);
+      closeAll();
+      return std::unique_ptr<SocketTransport>(
+          new SocketTransport(rank, std::move(own), {}));
+    }
+    children.push_back(pid);
+  }
+
+  std::vector<int> own;
+  own.swap(sockets[0]);
+  closeAll();
+  return std::unique_ptr<SocketTransport>(
+      new SocketTransport(0, std::move(own), std::move(children)));
+}
+
+SocketTransport::~SocketTransport() { Finish(true); }
+
+// All sends and receives advance in one poll() loop: a peer's socket buffer
+// only holds so much, a blocking send to it could wait for a receive that
+// peer is itself blocked before.
+void SocketTransport::Exchange(
+    std::span<const uint32_t> peers,
+    const std::vector<std::vector<uint8_t>> &outgoing,
+    std::vector<std::vector<uint8_t>> &incoming) {
+  const size_t peersNum = peers.size();
+  std::vector<Transfer> sends(peersNum), receives(peersNum);
+  std::vector<pollfd> fds(peersNum);
+  incoming.resize(peersNum);
+  for (size_t i = 0; i < peersNum; ++i) {
+    if (peers[i] >= m_sockets.size() || m_sockets[peers[i]] < 0) {
+      throw std::runtime_error("No socket to rank " +
+                               std::to_string(peers[i]));
+    }
+    sends[i].header = outgoing[i].size();
+    sends[i].total = HEADER_SIZE + outgoing[i].size();
+    incoming[i].clear();
+  }
+
+  auto pending = [&]() {
+    size_t active = 0;
+    for (size_t i = 0; i < peersNum; ++i) {
+      short events = (sends[i].done < sends[i].total ? POLLOUT : 0) |
+                     (receives[i].done < receives[i].total ? POLLIN : 0);
+      fds[i] = {events ? m_sockets[peers[i]] : -1, events, 0};
+      active += events != 0;
+    }
+    return active;
+  };
+
+  while (pending() > 0) {
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowError("poll");
+    }
+
+    for (size_t i = 0; i < peersNum; ++i) {
+      const int fd = fds[i].fd;
+      if (fd < 0 || fds[i].revents == 0) {
+        continue;
+      }
+
+      Transfer &send = sends[i];
+      if ((fds[i].revents & (POLLOUT | POLLERR)) && send.done < send.total) {
+        const bool header = send.done < HEADER_SIZE;
+        const uint8_t *data =
+            header ? (const uint8_t *)&send.header + send.done
+                   : outgoing[i].data() + (send.done - HEADER_SIZE);
+        size_t length =
+            header ? HEADER_SIZE - send.done : send.total - send.done;
+        ssize_t sent = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+          ThrowError("send");
+        }
+        send.done += sent > 0 ? sent : 0;
+      }
+
+      Transfer &receive = receives[i];
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+          receive.done < receive.total) {
+        const bool header = receive.done < HEADER_SIZE;
+        uint8_t *data =
+            header ? (uint8_t *)&receive.header + receive.done
+                   : incoming[i].data() + (receive.done - HEADER_SIZE);
+        size_t length =
+            header ? HEADER_SIZE - receive.done : receive.total - receive.done;
+        ssize_t received = recv(fd, data, length, 0);
+        if (received == 0) {
+          throw std::runtime_error("Rank " + std::to_string(peers[i]) +
+                                   " closed its connection");
+        }
+        if (received < 0 && errno != EAGAIN && errno != EINTR) {
+          ThrowError("recv");
+        }
+        receive.done += received > 0 ? received : 0;
+        if (header && receive.done == HEADER_SIZE) {
+          incoming[i].resize(receive.header);
+          receive.total = HEADER_SIZE + receive.header;
+        }
+      }
+    }
+  }
+}
+
+bool SocketTransport::Finish(bool ok) {
+  CloseAll(m_sockets);
+  for (int child : m_children) {
+    int status = 0;
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+  }
+  m_children.clear();
+  return ok;
+}
+
+#endif
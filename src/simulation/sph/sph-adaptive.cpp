@@ -0,0 +1,263 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "particle.h"
+#include "scan.h"
+#include "sph-internal.h"
+#include "sph-kernels.h"
+#include "sph.h"
+
+namespace {
+// merge partners are searched inside a chunk of the cell order, so chunks
+// are large enough to contain the neighbourhood of most of their particles
+const size_t PAIR_GRAIN = 4096;
+const uint32_t NO_PARTNER = std::numeric_limits<uint32_t>::max();
+// children of a split are placed this far from the parent in units of the
+// Init() spacing, along a horizontal direction that turns by the golden angle
+// from slot to slot
+const float SPLIT_OFFSET = 0.25f;
+const float GOLDEN_ANGLE = 2.39996323f;
+// support of the colour field in units of h, within h the few neighbours of
+// the Init() spacing make it too noisy to tell a merged pair from a surface
+const float SURFACE_SUPPORT = 2.f;
+
+enum ResampleAction : uint8_t { KEEP, MERGE, REMOVE, SPLIT };
+} // namespace
+
+// Adaptive resolution: deep particles merge pairwise into heavier ones, which
+// split back near the free surface. The smoothing length stays h for all of
+// them, so the mass ratio is kept small (Settings::maxMassScale); merges pair
+// equal masses and never make the count exceed the one of Init().
+void Sph::Resample(std::vector<Particle> &particles) {
+  if (m_settings.resampleInterval == 0 ||
+      m_settings.solver != SphSolver::WeaklyCompressible ||
+      ++m_stepsSinceResample < m_settings.resampleInterval) {
+    return;
+  }
+  m_stepsSinceResample = 0;
+  auto start = Clock::now();
+
+  DispatchKernels(SURFACE_SUPPORT * m_settings.h,
+                  [&](const auto &kernels) { DetectSurface(kernels); });
+  PairParticles();
+  WriteResampled(particles);
+
+  m_stats.positionsTime += ElapsedMs(start);
+}
+
+// m_surfaceDistance[i] is 0 where the colour field gradient of slot i marks
+// the free surface and the number of neighbour rings (of radius h) to it up to
+// Settings::surfaceDepth, one more beyond
+template <typename Kernels> void Sph::DetectSurface(const Kernels &kernels) {
+  const size_t particlesNum = m_soa.Size();
+  const float &support = kernels.h;
+  const float &h = m_settings.h;
+  const bool useList = m_settings.neighbourSkin > 0;
+  const float threshold = m_settings.surfaceThreshold / support;
+  const uint8_t deep = (uint8_t)std::min(m_settings.surfaceDepth + 1, 255u);
+  m_surfaceDistance.resize(particlesNum);
+  m_surfaceDistanceNext.resize(particlesNum);
+
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> candidates;
+    XMINT3 gathered(0, 0, 0);
+    for (size_t i = begin; i < end; ++i) {
+      Vector3 position = m_soa.Position(i);
+      Vector3 gradient = Vector3::Zero;
+      // the search covers whole cells, slots of one cell follow each other
+      // in the cell order and share it
+      XMINT3 cell = GetCell(position);
+      if (i == begin || cell.x != gathered.x || cell.y != gathered.y ||
+          cell.z != gathered.z) {
+        GatherCandidates(position, support, candidates);
+        gathered = cell;
+      }
+      for (uint32_t j : candidates) {
+        Vector3 r = Separation(position, m_soa.Position(j));
+        float d = r.Length();
+        if (d >= support || d == 0) {
+          continue;
+        }
+        float scale = m_soa.massScale.empty() ? 1.f : m_soa.massScale[j];
+        float volume = m_settings.mass * scale / m_soa.density[j];
+        gradient += volume * kernels.pressure.GradW(d) / d * r;
+      }
+      m_surfaceDistance[i] =
+          gradient.LengthSquared() > threshold * threshold ? 0 : deep;
+    }
+  });
+
+  for (uint8_t ring = 1; ring < deep; ++ring) {
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      std::vector<uint32_t> candidates;
+      for (size_t i = begin; i < end; ++i) {
+        m_surfaceDistanceNext[i] = m_surfaceDistance[i];
+        if (m_surfaceDistance[i] < ring) {
+          continue;
+        }
+        Vector3 position = m_soa.Position(i);
+        for (uint32_t j : Neighbours(i, useList, candidates)) {
+          if (m_surfaceDistance[j] == ring - 1 &&
+              Separation(position, m_soa.Position(j)).LengthSquared() <
+                  h * h) {
+            m_surfaceDistanceNext[i] = ring;
+            break;
+          }
+        }
+      }
+    });
+    m_surfaceDistance.swap(m_surfaceDistanceNext);
+  }
+}
+
+// Picks the action of every slot. A deep particle merges with the closest
+// deep, awake neighbour of the same mass that comes later in its chunk, so
+// chunks never compete for a partner. Heavy particles split closer than
+// Settings::surfaceDepth rings to the surface, the ring between the two keeps
+// particles from flipping back and forth.
+void Sph::PairParticles() {
+  const size_t particlesNum = m_soa.Size();
+  const uint32_t depth = m_settings.surfaceDepth;
+  const float h2 = m_settings.h * m_settings.h;
+  const bool useList = m_settings.neighbourSkin > 0;
+  auto massScale = [&](size_t i) {
+    return m_soa.massScale.empty() ? 1.f : m_soa.massScale[i];
+  };
+
+  m_resampleAction.assign(particlesNum, KEEP);
+  m_partner.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, PAIR_GRAIN, [&](size_t begin,
+                                                     size_t end) {
+    std::vector<uint32_t> candidates;
+    uint32_t merged = 0;
+    uint32_t split = 0;
+    for (size_t i = begin; i < end; ++i) {
+      float scale = massScale(i);
+      if (m_surfaceDistance[i] < depth) {
+        if (scale > 1) {
+          m_resampleAction[i] = SPLIT;
+          split++;
+        }
+        continue;
+      }
+      if (m_surfaceDistance[i] <= depth || m_resampleAction[i] != KEEP ||
+          Asleep(i) || 2 * scale > m_settings.maxMassScale) {
+        continue;
+      }
+
+      Vector3 position = m_soa.Position(i);
+      uint32_t partner = NO_PARTNER;
+      float closest = h2;
+      for (uint32_t j : Neighbours(i, useList, candidates)) {
+        if (j <= i || j >= end || m_resampleAction[j] != KEEP ||
+            m_surfaceDistance[j] <= depth || Asleep(j) ||
+            massScale(j) != scale) {
+          continue;
+        }
+        float d2 = Separation(position, m_soa.Position(j)).LengthSquared();
+        if (d2 < closest) {
+          closest = d2;
+          partner = j;
+        }
+      }
+      if (partner != NO_PARTNER) {
+        m_resampleAction[i] = MERGE;
+        m_resampleAction[partner] = REMOVE;
+        m_partner[i] = partner;
+        merged++;
+      }
+    }
+    std::atomic_ref<uint32_t>(m_stats.merged)
+        .fetch_add(merged, std::memory_order_relaxed);
+    std::atomic_ref<uint32_t>(m_stats.split)
+        .fetch_add(split, std::memory_order_relaxed);
+  });
+}
+
+// Writes the resampled particles in cell order, every slot at the offset of
+// an exclusive scan over the particles it turns into.
+void Sph::WriteResampled(std::vector<Particle> &particles) {
+  const size_t particlesNum = m_soa.Size();
+  const auto &entries = m_grid.Entries();
+  const float offset = SPLIT_OFFSET * INIT_SPACING * m_settings.h;
+  auto massScale = [&](uint32_t index) {
+    return m_massScale.empty() ? 1.f : m_massScale[index];
+  };
+
+  m_resampleOffset.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const uint8_t action = m_resampleAction[i];
+      m_resampleOffset[i] = action == REMOVE ? 0 : action == SPLIT ? 2 : 1;
+    }
+  });
+  const uint32_t resampledNum =
+      ExclusiveScan(m_resampleOffset.data(), m_resampleOffset.data(),
+                    particlesNum, m_pool);
+  if (m_stats.merged == 0 && m_stats.split == 0) {
+    return;
+  }
+
+  m_reordered.resize(resampledNum);
+  m_reorderedMass.resize(resampledNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const uint32_t out = m_resampleOffset[i];
+      Particle p = particles[entries[i]];
+      float scale = massScale(entries[i]);
+
+      switch (m_resampleAction[i]) {
+      case KEEP:
+        m_reordered[out] = p;
+        m_reorderedMass[out] = scale;
+        break;
+      case MERGE: {
+        // mass weighted, which conserves mass, momentum and the centre of
+        // mass of the pair
+        const Particle &q = particles[entries[m_partner[i]]];
+        float other = massScale(entries[m_partner[i]]);
+        float total = scale + other;
+        p.position += other / total * Separation(q.position, p.position);
+        WrapPosition(p.position);
+        p.velocity = (scale * p.velocity + other * q.velocity) / total;
+        p.force = (scale * p.force + other * q.force) / total;
+        p.density = (scale * p.density + other * q.density) / total;
+        p.pressure = (scale * p.pressure + other * q.pressure) / total;
+        p.hash = GetHash(GetCell(p.position));
+        m_reordered[out] = p;
+        m_reorderedMass[out] = total;
+        break;
+      }
+      case SPLIT: {
+        float angle = GOLDEN_ANGLE * i;
+        Vector3 shift =
+            offset * Vector3(std::cos(angle), 0, std::sin(angle));
+        for (uint32_t c = 0; c < 2; ++c) {
+          Particle child = p;
+          child.position += c == 0 ? shift : -shift;
+          CheckBoundary(child);
+          child.hash = GetHash(GetCell(child.position));
+          m_reordered[out + c] = child;
+          m_reorderedMass[out + c] = scale / 2;
+        }
+        break;
+      }
+      case REMOVE:
+        break;
+      }
+    }
+  });
+
+  // the particles are new, ids restart at their indices
+  particles.swap(m_reordered);
+  m_massScale.swap(m_reorderedMass);
+  m_ids.resize(resampledNum);
+  std::iota(m_ids.begin(), m_ids.end(), 0);
+  m_particlesChanged = true;
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "sph-internal.h"
+#include "sph-kernels.h"
+#include "sph-simd.h"
+#include "sph.h"
+
+namespace {
+// samples of the obstacle field closer than this many cells to the surface
+// are projected onto it, enough to leave no gaps between grid diagonals
+const float SURFACE_CELLS = 0.87f;
+} // namespace
+
+// Boundary particles after Akinci et al. 2012: particle b has the volume
+// V_b = 1 / sum_k W(x_b - x_k) over the boundary particles around it, so
+// densely sampled spots don't weigh more, and adds restDensity * V_b * W to
+// the density of the fluid around it. The pressure force mirrors the fluid
+// particle's own pressure and is clamped at 0, so walls push without
+// attracting the surface; with the k = 1 of the fluid it is scaled by
+// Settings::boundaryStiffness to stop a falling particle within one support.
+bool Sph::BoundaryEnabled() const {
+  return m_settings.boundaryParticles &&
+         m_settings.solver == SphSolver::WeaklyCompressible;
+}
+
+void Sph::BuildBoundary() {
+  if (!BoundaryEnabled()) {
+    return;
+  }
+
+  std::vector<Vector3> positions;
+  SampleBox(positions);
+  SampleObstacles(positions);
+
+  // the grid is built once, the particles go to its slot order
+  const size_t boundaryNum = positions.size();
+  std::vector<uint32_t> keys(boundaryNum);
+  for (size_t i = 0; i < boundaryNum; ++i) {
+    keys[i] = GetHash(GetCell(positions[i]));
+  }
+  m_boundaryGrid.Build(keys, m_tableSize, m_pool);
+
+  // the bulk of the fluid skips the search, hash collisions only add keys
+  m_boundaryNear.assign(m_tableSize, 0);
+  for (size_t i = 0; i < boundaryNum; ++i) {
+    if (i > 0 && keys[i] == keys[i - 1]) {
+      continue;
+    }
+    XMINT3 cell = GetCell(positions[i]);
+    for (int x = -1; x <= 1; x++) {
+      for (int y = -1; y <= 1; y++) {
+        for (int z = -1; z <= 1; z++) {
+          m_boundaryNear[GetHash(XMINT3(cell.x + x, cell.y + y, cell.z + z))] =
+              1;
+        }
+      }
+    }
+  }
+
+  const auto &entries = m_boundaryGrid.Entries();
+  m_boundary.Resize(boundaryNum);
+  m_pool.ParallelFor(0, boundaryNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Vector3 &position = positions[entries[i]];
+      m_boundary.x[i] = position.x;
+      m_boundary.y[i] = position.y;
+      m_boundary.z[i] = position.z;
+      m_boundary.hash[i] = keys[entries[i]];
+    }
+  });
+
+  std::vector<float> massScale(boundaryNum);
+  DispatchKernels(SupportRadius(), [&](const auto &kernels) {
+    m_pool.ParallelFor(0, boundaryNum, GRAIN, [&](size_t begin, size_t end) {
+      std::vector<uint32_t> candidates;
+      for (size_t i = begin; i < end; ++i) {
+        Vector3 position = m_boundary.Position(i);
+        GatherCandidates(m_boundaryGrid, position, SupportRadius(),
+                         candidates);
+        float sum =
+            SimdDensitySum(m_boundary, candidates.data(), candidates.size(),
+                           position, m_period, kernels);
+        massScale[i] = m_settings.restDensity / (sum * m_settings.mass);
+      }
+    });
+  });
+  m_boundary.massScale.swap(massScale);
+}
+
+// Floor and side walls of the boundary box in layers of boundarySpacing
+// reaching h outwards, so a particle that is pushed onto a wall still has
+// boundary particles behind it. The fluid never reaches the top of the box.
+// A periodic box only has its floor, tiled to repeat with the period.
+void Sph::SampleBox(std::vector<Vector3> &positions) const {
+  const Vector3 &len = m_settings.boundaryLen;
+  const Vector3 &offset = m_settings.worldOffset;
+  const float spacing = m_settings.boundarySpacing;
+  const int nx = (int)std::round(len.x / spacing);
+  const int ny = (int)std::round(len.y / spacing);
+  const int nz = (int)std::round(len.z / spacing);
+  const Vector3 step = Vector3(len.x / nx, len.y / ny, len.z / nz);
+  const int layers = (int)std::ceil(m_settings.h / spacing);
+  auto add = [&](int x, int y, int z) {
+    positions.push_back(offset + Vector3(x * step.x, y * step.y, z * step.z));
+  };
+
+  if (m_settings.periodic) {
+    for (int z = 0; z < nz; ++z) {
+      for (int y = 1 - layers; y <= 0; ++y) {
+        for (int x = 0; x < nx; ++x) {
+          add(x, y, z);
+        }
+      }
+    }
+    return;
+  }
+
+  for (int z = 1 - layers; z < nz + layers; ++z) {
+    for (int y = 1 - layers; y <= ny; ++y) {
+      if (y <= 0 || z <= 0 || z >= nz) {
+        for (int x = 1 - layers; x < nx + layers; ++x) {
+          add(x, y, z);
+        }
+        continue;
+      }
+      for (int l = 0; l < layers; ++l) {
+        add(-l, y, z);
+        add(nx + l, y, z);
+      }
+    }
+  }
+}
+
+// Samples of the obstacle field up to h inside the surface, the ones near it
+// moved onto it along the gradient. The spacing follows the field cells
+// rather than boundarySpacing.
+void Sph::SampleObstacles(std::vector<Vector3> &positions) const {
+  if (m_obstacles.Empty()) {
+    return;
+  }
+
+  const XMINT3 samplesNum = m_obstacles.GetSamplesNum();
+  const float cellSize = m_obstacles.GetCellSize();
+  const Vector3 origin = m_obstacles.GetOrigin();
+  for (int z = 0; z < samplesNum.z; ++z) {
+    for (int y = 0; y < samplesNum.y; ++y) {
+      for (int x = 0; x < samplesNum.x; ++x) {
+        Vector3 position = origin + cellSize * Vector3((float)x, (float)y,
+                                                       (float)z);
+        Vector3 gradient;
+        float distance = m_obstacles.Distance(position, gradient);
+        if (distance >= SURFACE_CELLS * cellSize ||
+            distance <= -m_settings.h || gradient.LengthSquared() == 0) {
+          continue;
+        }
+        // the deeper samples stay where they are
+        if (distance > -SURFACE_CELLS * cellSize) {
+          gradient.Normalize();
+          position -= distance * gradient;
+        }
+        positions.push_back(position);
+      }
+    }
+  }
+}
+
+template <typename Kernels>
+float Sph::BoundaryDensity(const Kernels &kernels, size_t i,
+                           std::vector<uint32_t> &candidates) const {
+  if (!m_boundaryNear[m_soa.hash[i]]) {
+    return 0;
+  }
+  Vector3 position = m_soa.Position(i);
+  GatherCandidates(m_boundaryGrid, position, SupportRadius(), candidates);
+  return SimdDensitySum(m_boundary, candidates.data(), candidates.size(),
+                        position, m_period, kernels);
+}
+
+// -boundaryStiffness sum_b restDensity V_b max(p_i, 0) / density_i grad W,
+// per volume like the fluid forces
+template <typename Kernels>
+Vector3 Sph::BoundaryForce(const Kernels &kernels, size_t i,
+                           std::vector<uint32_t> &candidates) const {
+  const float pressure = std::max(m_soa.pressure[i], 0.f);
+  if (pressure == 0 || !m_boundaryNear[m_soa.hash[i]]) {
+    return Vector3::Zero;
+  }
+
+  const float &support = kernels.h;
+  Vector3 position = m_soa.Position(i);
+  GatherCandidates(m_boundaryGrid, position, support, candidates);
+  Vector3 force = Vector3::Zero;
+  for (uint32_t b : candidates) {
+    Vector3 r = Separation(position, m_boundary.Position(b));
+    float d = r.Length();
+    if (d >= support || d == 0) {
+      continue;
+    }
+    force -= m_boundary.massScale[b] * kernels.pressure.GradW(d) / d * r;
+  }
+  return m_settings.boundaryStiffness * m_settings.mass * pressure /
+         m_soa.density[i] * force;
+}
+
+#define INSTANTIATE_KERNELS(Kernels)                                           \
+  template float Sph::BoundaryDensity(const Kernels &, size_t,                 \
+                                      std::vector<uint32_t> &) const;          \
+  template Vector3 Sph::BoundaryForce(const Kernels &, size_t,                 \
+                                      std::vector<uint32_t> &) const;
+
+INSTANTIATE_KERNELS(kernels::Mueller)
+INSTANTIATE_KERNELS(kernels::Cubic)
+INSTANTIATE_KERNELS(kernels::Wendland)
+#undef INSTANTIATE_KERNELS
@@ -351,6 +351,8 @@ void SphGpu::CreateHash() {
     pContext->CSSetShaderResources(0, 1, srvs);
     pContext->CSSetUnorderedAccessViews(0, 1, uavs, nullptr);
 
+    // ScanCS reads every slot, so unlike CellGrid the counts cannot be
+    // epoch-stamped and the table is cleared as a whole
     pContext->CSSetShader(m_pClearTableCS.Get(), nullptr, 0);
     pContext->Dispatch(DivUp(m_settings.TABLE_SIZE + 1, m_settings.blockSize),
                        1, 1);
@@ -0,0 +1,179 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "particle.h"
+#include "sph-internal.h"
+#include "sph-kernels.h"
+#include "sph.h"
+
+// IISPH (Ihmsen et al. 2014) in the form of Koschier et al. 2019: the
+// pressure solves A p = restDensity - advected density, where A p is the
+// density change the pressure accelerations cause over dt. Every Jacobi
+// iteration evaluates the accelerations, then A p and the pressure update.
+template <typename Kernels>
+void Sph::IisphSolve(const Kernels &kernels, float dt) {
+  const size_t particlesNum = m_soa.Size();
+  const float &h = kernels.h;
+  const float h2 = h * h;
+  const float mass = m_settings.mass;
+  const float dt2 = dt * dt;
+  const float restDensity = LatticeDensity(h);
+  auto start = Clock::now();
+
+  // velocities without pressure, their density change and the diagonal of A
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      IISPHParticle &p = m_iisph[i];
+      Vector3 force(m_soa.fx[i], m_soa.fy[i], m_soa.fz[i]);
+      p.velocity = m_soa.Velocity(i) + dt * force / m_soa.density[i];
+    }
+  });
+
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      IISPHParticle &p = m_iisph[i];
+      Vector3 position = m_soa.Position(i);
+      Vector3 velocity = p.velocity;
+      const uint32_t *list = m_neighbourList.Begin(i);
+
+      float divergence = 0;
+      float gradient2 = 0;
+      Vector3 gradient = Vector3::Zero;
+      for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+        uint32_t j = list[c];
+        Vector3 r = Separation(position, m_soa.Position(j));
+        float d2 = r.LengthSquared();
+        if (d2 >= h2 || d2 == 0) {
+          continue;
+        }
+        float d = std::sqrt(d2);
+        Vector3 grad = r * (kernels.pressure.GradW(d) / d);
+        divergence += (velocity - Vector3(m_iisph[j].velocity)).Dot(grad);
+        gradient += grad;
+        gradient2 += grad.LengthSquared();
+      }
+
+      float density = m_soa.density[i];
+      p.source = restDensity - density - dt * mass * divergence;
+      p.diagonal = -dt2 * mass * mass / (density * density) *
+                   (gradient.LengthSquared() + gradient2);
+    }
+  });
+
+  m_stats.densityTime += ElapsedMs(start);
+  start = Clock::now();
+
+  // pressure accelerations of the current pressures
+  auto accelerations = [&]() {
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        IISPHParticle &p = m_iisph[i];
+        Vector3 position = m_soa.Position(i);
+        float density = m_soa.density[i];
+        float pi = p.pressure / (density * density);
+        const uint32_t *list = m_neighbourList.Begin(i);
+
+        Vector3 acceleration = Vector3::Zero;
+        for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+          uint32_t j = list[c];
+          Vector3 r = Separation(position, m_soa.Position(j));
+          float d2 = r.LengthSquared();
+          if (d2 >= h2 || d2 == 0) {
+            continue;
+          }
+          float d = std::sqrt(d2);
+          float other = m_soa.density[j];
+          float pj = m_iisph[j].pressure / (other * other);
+          acceleration -=
+              r * (mass * (pi + pj) * kernels.pressure.GradW(d) / d);
+        }
+        p.pressureAccel = acceleration;
+      }
+    });
+  };
+
+  const size_t chunksNum = (particlesNum + GRAIN - 1) / GRAIN;
+  uint32_t iteration = 0;
+  float error = 0;
+  while (iteration < m_settings.iisphMaxIterations) {
+    accelerations();
+
+    // relaxed Jacobi update, the mean compression is summed per task; a pool
+    // without workers runs the whole range as one task into slot 0
+    m_chunkCompression.assign(chunksNum, 0);
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      float compression = 0;
+      for (size_t i = begin; i < end; ++i) {
+        IISPHParticle &p = m_iisph[i];
+        Vector3 position = m_soa.Position(i);
+        Vector3 acceleration = p.pressureAccel;
+        const uint32_t *list = m_neighbourList.Begin(i);
+
+        float divergence = 0;
+        for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+          uint32_t j = list[c];
+          Vector3 r = Separation(position, m_soa.Position(j));
+          float d2 = r.LengthSquared();
+          if (d2 >= h2 || d2 == 0) {
+            continue;
+          }
+          float d = std::sqrt(d2);
+          Vector3 grad = r * (kernels.pressure.GradW(d) / d);
+          divergence +=
+              (acceleration - Vector3(m_iisph[j].pressureAccel)).Dot(grad);
+        }
+
+        float product = dt2 * mass * divergence;
+        if (p.diagonal < 0) {
+          float pressure = p.pressure + m_settings.iisphOmega *
+                                            (p.source - product) / p.diagonal;
+          p.pressure = std::max(pressure, 0.f);
+        } else {
+          p.pressure = 0;
+        }
+        // expansion at the surface is not corrected and does not count
+        compression += std::max(product - p.source, 0.f);
+      }
+      m_chunkCompression[begin / GRAIN] += compression;
+    });
+
+    ++iteration;
+    error = 0;
+    for (float compression : m_chunkCompression) {
+      error += compression;
+    }
+    error /= particlesNum * restDensity;
+    if (iteration >= m_settings.iisphMinIterations &&
+        error <= m_settings.iisphMaxError) {
+      break;
+    }
+  }
+
+  // the pressure force goes with the others to Integrate()
+  accelerations();
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const IISPHParticle &p = m_iisph[i];
+      float density = m_soa.density[i];
+      m_soa.fx[i] += density * p.pressureAccel.x;
+      m_soa.fy[i] += density * p.pressureAccel.y;
+      m_soa.fz[i] += density * p.pressureAccel.z;
+      m_soa.pressure[i] = p.pressure;
+    }
+  });
+
+  m_stats.pressureIterations += iteration;
+  m_stats.densityError = error;
+  m_stats.forcesTime += ElapsedMs(start);
+}
+
+void Sph::SolvePressure(float dt) {
+  if (m_settings.solver != SphSolver::Implicit) {
+    return;
+  }
+  DispatchKernels(SupportRadius(),
+                  [&](const auto &kernels) { IisphSolve(kernels, dt); });
+}
@@ -0,0 +1,68 @@
+#include <span>
+
+#include "sph.h"
+
+// Every body gets its own field in pivot space, so moving it only changes the
+// transform a lookup goes through. Posing is once per Update(), the frame's
+// substeps see the body where it is at the end of the frame, with the
+// velocity of its script there.
+void Sph::BuildKinematics() {
+  const auto &bodies = m_settings.kinematicBodies;
+  m_bodyFields.assign(bodies.size(), SignedDistanceField());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    BuildField(std::span(&bodies[i].shape, 1), m_bodyFields[i]);
+  }
+  m_time = 0;
+  UpdateKinematics(m_time);
+}
+
+void Sph::UpdateKinematics(float time) {
+  const auto &bodies = m_settings.kinematicBodies;
+  m_bodyPoses.resize(bodies.size());
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    m_bodyPoses[i] = EvaluatePose(bodies[i], time);
+  }
+}
+
+// Like CollideObstacles() at a clearance of h, with the approach measured
+// against the velocity of the body surface: a particle in front of a moving
+// body leaves it at least as fast as the body comes.
+bool Sph::CollideKinematics(Particle &p) const {
+  const float &h = m_settings.h;
+  bool touched = false;
+  for (size_t i = 0; i < m_bodyFields.size(); ++i) {
+    const KinematicPose &pose = m_bodyPoses[i];
+    Vector3 gradient;
+    float distance = m_bodyFields[i].Distance(pose.ToLocal(p.position),
+                                              gradient);
+    if (distance >= h || gradient.LengthSquared() == 0) {
+      continue;
+    }
+    Vector3 normal = pose.ToWorld(gradient);
+    normal.Normalize();
+
+    p.position += 2 * (h - distance) * normal;
+    float approach = (p.velocity - pose.VelocityAt(p.position)).Dot(normal);
+    if (approach < 0) {
+      p.velocity -= (1 + m_settings.dampingCoeff) * approach * normal;
+    }
+    touched = true;
+  }
+  return touched;
+}
+
+void Sph::ClampToKinematics(Vector3 &position) const {
+  const float &h = m_settings.h;
+  for (size_t i = 0; i < m_bodyFields.size(); ++i) {
+    const KinematicPose &pose = m_bodyPoses[i];
+    Vector3 gradient;
+    float distance = m_bodyFields[i].Distance(pose.ToLocal(position),
+                                              gradient);
+    if (distance >= h || gradient.LengthSquared() == 0) {
+      continue;
+    }
+    Vector3 normal = pose.ToWorld(gradient);
+    normal.Normalize();
+    position += (h - distance) * normal;
+  }
+}
@@ -0,0 +1,120 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "sph-internal.h"
+#include "sph.h"
+
+namespace {
+// levels above this would split a frame into more than 128 substeps
+const uint32_t MAX_LEVELS = 8;
+} // namespace
+
+// Block time stepping: a frame of dt is split into 2^(levels - 1) substeps,
+// a particle of level l gets new densities and forces and a velocity kick of
+// dt / 2^l every 2^(levels - 1 - l) substeps, and drifts with its velocity in
+// all of them. Every level is at a boundary in the first substep, where the
+// levels are assigned for the whole frame, so the neighbours a particle sees
+// are always at the time of its own step.
+bool Sph::MultiRateEnabled() const {
+  return m_settings.timeStepLevels > 1 &&
+         m_settings.solver == SphSolver::WeaklyCompressible;
+}
+
+void Sph::MultiRateStep(float dt, std::vector<Particle> &particles,
+                        bool reordered) {
+  m_levelsNum = std::min(m_settings.timeStepLevels, MAX_LEVELS);
+  const uint32_t substeps = 1u << (m_levelsNum - 1);
+  const float step = dt / substeps;
+  m_frameDt = dt;
+
+  for (m_substep = 0; m_substep < substeps; ++m_substep) {
+    UpdateForces(particles, reordered && m_substep == 0);
+    if (m_substep == 0) {
+      AssignLevels(dt);
+    }
+    Integrate(step, particles);
+  }
+  m_substep = 0;
+
+  m_stats.substeps = substeps;
+  m_stats.dt = step;
+}
+
+// The level of a particle is the smallest one whose step stays within the
+// cflFactor and forceFactor limits of its velocity and acceleration. It is
+// then raised to at most one below the finest of its neighbours, so a fast
+// particle never runs into one that only reacts at the end of the frame.
+void Sph::AssignLevels(float dt) {
+  const size_t particlesNum = m_soa.Size();
+  const auto &entries = m_grid.Entries();
+  const float &h = m_settings.h;
+  const bool useList = m_settings.neighbourSkin > 0;
+  const uint8_t finest = (uint8_t)(m_levelsNum - 1);
+
+  m_slotLevel.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Vector3 acceleration =
+          Vector3(m_soa.fx[i], m_soa.fy[i], m_soa.fz[i]) / m_soa.density[i];
+      float velocity2 = m_soa.Velocity(i).LengthSquared();
+      float acceleration2 = acceleration.LengthSquared();
+
+      float limit = std::numeric_limits<float>::infinity();
+      if (velocity2 > 0) {
+        limit = m_settings.cflFactor * h / std::sqrt(velocity2);
+      }
+      if (acceleration2 > 0) {
+        limit = std::min(limit, m_settings.forceFactor *
+                                    std::sqrt(h / std::sqrt(acceleration2)));
+      }
+
+      uint8_t level = 0;
+      while (level < finest && dt / (1u << level) > limit) {
+        level++;
+      }
+      m_slotLevel[i] = level;
+    }
+  });
+
+  m_level.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> candidates;
+    for (size_t i = begin; i < end; ++i) {
+      uint8_t level = m_slotLevel[i];
+      for (uint32_t j : Neighbours(i, useList, candidates)) {
+        if (m_slotLevel[j] > level + 1) {
+          level = m_slotLevel[j] - 1;
+        }
+      }
+      m_level[entries[i]] = level;
+    }
+  });
+}
+
+void Sph::MarkWaiting() {
+  if (!MultiRateEnabled() || m_substep == 0) {
+    m_waiting.clear();
+    return;
+  }
+
+  const size_t particlesNum = m_soa.Size();
+  const auto &entries = m_grid.Entries();
+  m_waiting.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      uint32_t stride = 1u << (m_levelsNum - 1 - m_level[entries[i]]);
+      m_waiting[i] = m_substep % stride != 0;
+    }
+  });
+}
+
+float Sph::KickStep(uint32_t index, float dt) const {
+  if (!MultiRateEnabled() || m_level.size() <= index) {
+    return dt;
+  }
+  return m_frameDt / (1u << m_level[index]);
+}
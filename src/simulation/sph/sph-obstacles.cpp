@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "obj-mesh.h"
+#include "sph.h"
+
+// Obstacles are baked once into a signed distance field over their padded
+// bounds, so a particle pays one trilinear lookup per step however many of
+// them there are and whatever their shape. Meshes are loaded here, so a
+// missing file throws from Init().
+void Sph::BuildObstacles() { BuildField(m_settings.obstacles, m_obstacles); }
+
+void Sph::BuildField(std::span<const Obstacle> shapes,
+                     SignedDistanceField &field) {
+  if (shapes.empty()) {
+    return;
+  }
+
+  Vector3 min = Vector3(std::numeric_limits<float>::max());
+  Vector3 max = -min;
+  std::vector<ObjMesh> meshes(shapes.size());
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const Obstacle &o = shapes[i];
+    if (o.shape == ObstacleShape::Mesh) {
+      LoadObj(o.mesh, meshes[i], m_pool);
+      for (Vector3 &v : meshes[i].vertices) {
+        v = o.center + o.size.x * v;
+        min = Vector3::Min(min, v);
+        max = Vector3::Max(max, v);
+      }
+      continue;
+    }
+
+    Vector3 extent = o.size;
+    if (o.shape == ObstacleShape::Sphere) {
+      extent = Vector3(o.size.x);
+    } else if (o.shape == ObstacleShape::Cylinder) {
+      extent = Vector3(o.size.x, o.size.y, o.size.x);
+    }
+    min = Vector3::Min(min, o.center - extent);
+    max = Vector3::Max(max, o.center + extent);
+  }
+  // distances within the padding of 2 h decide the collisions
+  Vector3 padding = Vector3(2 * m_settings.h);
+  field.Reset(min - padding, max + padding, m_settings.obstacleCellSize);
+
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    const Obstacle &o = shapes[i];
+    switch (o.shape) {
+    case ObstacleShape::Box:
+      field.AddBox(o.center, o.size, m_pool);
+      break;
+    case ObstacleShape::Sphere:
+      field.AddSphere(o.center, o.size.x, m_pool);
+      break;
+    case ObstacleShape::Cylinder:
+      field.AddCylinder(o.center, o.size.x, o.size.y, m_pool);
+      break;
+    case ObstacleShape::Mesh:
+      field.AddMesh(meshes[i].vertices, meshes[i].indices, padding.x,
+                    m_pool);
+      break;
+    }
+  }
+}
+
+Vector3 Sph::ObstacleAcceleration(const Vector3 &position) const {
+  const float &h = m_settings.h;
+  Vector3 normal;
+  float distance = m_obstacles.Distance(position, normal);
+  if (distance >= h || normal.LengthSquared() == 0) {
+    return Vector3::Zero;
+  }
+  normal.Normalize();
+  return m_settings.obstacleRepulsion * (h - distance) * normal;
+}
+
+// Same as a wall of the boundary box: the particle is mirrored at the
+// clearance along the field gradient and its normal velocity is reflected and
+// damped.
+void Sph::CollideObstacles(Particle &p) const {
+  const bool pushed = m_settings.obstacleRepulsion > 0 || BoundaryEnabled();
+  const float clearance = pushed ? 0 : m_settings.h;
+  Vector3 normal;
+  float distance = m_obstacles.Distance(p.position, normal);
+  if (distance >= clearance || normal.LengthSquared() == 0) {
+    return;
+  }
+  normal.Normalize();
+
+  p.position += 2 * (clearance - distance) * normal;
+  float approach = p.velocity.Dot(normal);
+  if (approach < 0) {
+    p.velocity -= (1 + m_settings.dampingCoeff) * approach * normal;
+  }
+}
+
+void Sph::ClampToObstacles(Vector3 &position) const {
+  const float &h = m_settings.h;
+  Vector3 normal;
+  float distance = m_obstacles.Distance(position, normal);
+  if (distance >= h || normal.LengthSquared() == 0) {
+    return;
+  }
+  normal.Normalize();
+  position += (h - distance) * normal;
+}
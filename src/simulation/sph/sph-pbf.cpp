@@ -0,0 +1,240 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "particle.h"
+#include "sph-internal.h"
+#include "sph-kernels.h"
+#include "sph.h"
+
+namespace {
+const Vector3 GRAVITY = Vector3(0, -9.8f, 0);
+// neighbours move during the iterations, the lists keep a margin of h / 10
+const float LIST_MARGIN = 0.1f;
+// artificial pressure reference distance and exponent
+const float DELTA_Q = 0.2f;
+const int TENSILE_POWER = 4;
+// the walls only clamp positions, particles squeezed into an edge of the box
+// would otherwise be shot along it; corrections are limited to h / 4 per
+// iteration
+const float MAX_CORRECTION = 0.25f;
+} // namespace
+
+template <typename Kernels>
+void Sph::PbfSolve(const Kernels &kernels, float dt) {
+  const size_t particlesNum = m_pbParticles.size();
+  const float &h = kernels.h;
+  const float h2 = h * h;
+  const float restDensity = LatticeDensity(h);
+  const float volume = m_settings.mass / restDensity;
+  const float wDeltaQ = kernels.density.W(DELTA_Q * h);
+  const float maxCorrection = MAX_CORRECTION * m_settings.h;
+
+  for (uint32_t iteration = 0; iteration < m_settings.pbfIterations;
+       ++iteration) {
+    auto start = Clock::now();
+
+    // density constraint C = density / restDensity - 1 and its multiplier
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        PBParticle &p = m_pbParticles[i];
+        Vector3 position = p.predictedPosition;
+        const uint32_t *list = m_neighbourList.Begin(i);
+
+        float density = 0;
+        float gradient2 = 0;
+        Vector3 gradient = Vector3::Zero;
+        for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+          const PBParticle &other = m_pbParticles[list[c]];
+          Vector3 r = Separation(position, other.predictedPosition);
+          float d2 = r.LengthSquared();
+          if (d2 >= h2) {
+            continue;
+          }
+          density += other.mass * kernels.density.W2(d2);
+          if (d2 > 0) {
+            float d = std::sqrt(d2);
+            Vector3 grad = r * (volume * kernels.pressure.GradW(d) / d);
+            gradient += grad;
+            gradient2 += grad.LengthSquared();
+          }
+        }
+
+        // only compression is corrected, free surface particles with few
+        // neighbours would otherwise clump
+        float constraint = std::max(density / restDensity - 1, 0.f);
+        p.density = density;
+        p.lambda = -constraint / (gradient2 + gradient.LengthSquared() +
+                                  m_settings.pbfRelaxation);
+      }
+    });
+
+    m_stats.densityTime += ElapsedMs(start);
+    start = Clock::now();
+
+    // Jacobi position corrections with the artificial pressure term
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        PBParticle &p = m_pbParticles[i];
+        Vector3 position = p.predictedPosition;
+        const uint32_t *list = m_neighbourList.Begin(i);
+
+        Vector3 delta = Vector3::Zero;
+        for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+          const PBParticle &other = m_pbParticles[list[c]];
+          Vector3 r = Separation(position, other.predictedPosition);
+          float d2 = r.LengthSquared();
+          if (d2 >= h2 || d2 == 0) {
+            continue;
+          }
+          float d = std::sqrt(d2);
+          float ratio = kernels.density.W(d) / wDeltaQ;
+          float tensile = -m_settings.pbfTensileK * h2;
+          for (int k = 0; k < TENSILE_POWER; ++k) {
+            tensile *= ratio;
+          }
+          delta += r * ((p.lambda + other.lambda + tensile) *
+                        kernels.pressure.GradW(d) / d);
+        }
+        delta *= volume;
+        float length2 = delta.LengthSquared();
+        if (length2 > maxCorrection * maxCorrection) {
+          delta *= maxCorrection / std::sqrt(length2);
+        }
+        p.deltaP = delta;
+      }
+    });
+
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        PBParticle &p = m_pbParticles[i];
+        Vector3 position =
+            Vector3(p.predictedPosition) + Vector3(p.deltaP);
+        ClampToBoundary(position);
+        p.predictedPosition = position;
+      }
+    });
+
+    m_stats.forcesTime += ElapsedMs(start);
+  }
+
+  auto start = Clock::now();
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      PBParticle &p = m_pbParticles[i];
+      p.velocity = Separation(p.predictedPosition, p.position) / dt;
+    }
+  });
+
+  // XSPH viscosity, the smoothed velocities go to the SoA
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const PBParticle &p = m_pbParticles[i];
+      Vector3 position = p.predictedPosition;
+      Vector3 velocity = p.velocity;
+      const uint32_t *list = m_neighbourList.Begin(i);
+
+      Vector3 smoothing = Vector3::Zero;
+      for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+        const PBParticle &other = m_pbParticles[list[c]];
+        Vector3 r = Separation(position, other.predictedPosition);
+        float d2 = r.LengthSquared();
+        if (d2 >= h2 || other.density <= 0) {
+          continue;
+        }
+        smoothing += (Vector3(other.velocity) - velocity) *
+                     (other.mass / other.density * kernels.density.W2(d2));
+      }
+
+      velocity += m_settings.xsphViscosity * smoothing;
+      m_soa.vx[i] = velocity.x;
+      m_soa.vy[i] = velocity.y;
+      m_soa.vz[i] = velocity.z;
+    }
+  });
+  m_stats.positionsTime += ElapsedMs(start);
+}
+
+void Sph::PbfStep(float dt, std::vector<Particle> &particles) {
+  const size_t particlesNum = particles.size();
+  const float &h = m_settings.h;
+  auto start = Clock::now();
+
+  // predict positions and sort the predictions into the grid
+  m_predicted.resize(particlesNum);
+  m_keys.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Vector3 velocity = particles[i].velocity + dt * GRAVITY;
+      Vector3 position = particles[i].position + dt * velocity;
+      ClampToBoundary(position);
+      m_predicted[i] = position;
+      m_keys[i] = GetHash(GetCell(position));
+    }
+  });
+  SortKeys();
+
+  const auto &entries = m_grid.Entries();
+  m_pbParticles.resize(particlesNum);
+  m_soa.Resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const Particle &src = particles[entries[i]];
+      PBParticle &p = m_pbParticles[i];
+      p.position = src.position;
+      p.velocity = src.velocity;
+      p.force = m_settings.mass * GRAVITY;
+      p.predictedPosition = m_predicted[entries[i]];
+      p.deltaP = Vector3::Zero;
+      p.lambda = 0;
+      p.density = 0;
+      p.mass = m_settings.mass;
+
+      m_soa.x[i] = p.predictedPosition.x;
+      m_soa.y[i] = p.predictedPosition.y;
+      m_soa.z[i] = p.predictedPosition.z;
+      m_soa.hash[i] = m_keys[entries[i]];
+    }
+  });
+
+  m_neighbourList.Build(m_soa, m_settings.incompressibleSupport * h,
+                        LIST_MARGIN * h, m_period, ListCandidates(), m_pool);
+  m_stats.neighbourListBuilds++;
+  m_stats.hashTime += ElapsedMs(start);
+
+  DispatchKernels(m_settings.incompressibleSupport * h,
+                  [&](const auto &kernels) { PbfSolve(kernels, dt); });
+
+  start = Clock::now();
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      const PBParticle &p = m_pbParticles[i];
+      Particle &dst = particles[entries[i]];
+      dst.position = p.predictedPosition;
+      dst.velocity = m_soa.Velocity(i);
+      dst.force = p.force;
+      dst.density = p.density;
+      dst.pressure = 0;
+    }
+  });
+  m_stats.positionsTime += ElapsedMs(start);
+
+  // the lists were built on predicted positions
+  m_neighbourList.Invalidate();
+}
+
+void Sph::ClampToBoundary(Vector3 &position) const {
+  const float &h = m_settings.h;
+  WrapPosition(position);
+  Vector3 localPos = position - m_settings.worldOffset;
+  if (!m_settings.periodic) {
+    localPos.x = std::clamp(localPos.x, h, m_settings.boundaryLen.x - h);
+    localPos.z = std::clamp(localPos.z, h, m_settings.boundaryLen.z - h);
+  }
+  localPos.y = std::clamp(localPos.y, h, m_settings.boundaryLen.y - h);
+  position = localPos + m_settings.worldOffset;
+  ClampToObstacles(position);
+  ClampToKinematics(position);
+}
@@ -0,0 +1,351 @@
+#include "sph-simd.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SPH_SIMD_SSE
+#endif
+
+namespace {
+
+// Minimal batch of floats, masks are all-ones/all-zeros lanes and And() keeps
+// the lanes of `a` where the mask is set.
+#if defined(__AVX2__)
+struct Batch {
+  static const uint32_t WIDTH = 8;
+  __m256 v;
+
+  static Batch Set(float f) { return {_mm256_set1_ps(f)}; }
+  static Batch Gather(const float *base, const uint32_t *idx) {
+    return {_mm256_i32gather_ps(
+        base, _mm256_loadu_si256((const __m256i *)idx), sizeof(float))};
+  }
+  static Batch LaneMask(uint32_t lanes) {
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    return {_mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), lane))};
+  }
+  void Store(float *dst) const { _mm256_storeu_ps(dst, v); }
+  float Sum() const {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+inline Batch operator+(Batch a, Batch b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline Batch operator-(Batch a, Batch b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline Batch operator*(Batch a, Batch b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline Batch operator/(Batch a, Batch b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline Batch Sqrt(Batch a) { return {_mm256_sqrt_ps(a.v)}; }
+inline Batch Round(Batch a) {
+  return {_mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)};
+}
+inline Batch Min(Batch a, Batch b) { return {_mm256_min_ps(a.v, b.v)}; }
+inline Batch Max(Batch a, Batch b) { return {_mm256_max_ps(a.v, b.v)}; }
+inline Batch Less(Batch a, Batch b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+inline Batch And(Batch mask, Batch a) { return {_mm256_and_ps(mask.v, a.v)}; }
+
+const char *PATH_NAME = "AVX2";
+#elif defined(SPH_SIMD_SSE)
+struct Batch {
+  static const uint32_t WIDTH = 4;
+  __m128 v;
+
+  static Batch Set(float f) { return {_mm_set1_ps(f)}; }
+  static Batch Gather(const float *base, const uint32_t *idx) {
+    return {_mm_setr_ps(base[idx[0]], base[idx[1]], base[idx[2]],
+                        base[idx[3]])};
+  }
+  static Batch LaneMask(uint32_t lanes) {
+    __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    return {_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_set1_epi32(lanes), lane))};
+  }
+  void Store(float *dst) const { _mm_storeu_ps(dst, v); }
+  float Sum() const {
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+inline Batch operator+(Batch a, Batch b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Batch operator-(Batch a, Batch b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Batch operator*(Batch a, Batch b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Batch operator/(Batch a, Batch b) { return {_mm_div_ps(a.v, b.v)}; }
+inline Batch Sqrt(Batch a) { return {_mm_sqrt_ps(a.v)}; }
+// SSE2 has no round, the conversion rounds to nearest
+inline Batch Round(Batch a) { return {_mm_cvtepi32_ps(_mm_cvtps_epi32(a.v))}; }
+inline Batch Min(Batch a, Batch b) { return {_mm_min_ps(a.v, b.v)}; }
+inline Batch Max(Batch a, Batch b) { return {_mm_max_ps(a.v, b.v)}; }
+inline Batch Less(Batch a, Batch b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline Batch And(Batch mask, Batch a) { return {_mm_and_ps(mask.v, a.v)}; }
+
+const char *PATH_NAME = "SSE";
+#else
+struct Batch {
+  static const uint32_t WIDTH = 1;
+  float v;
+
+  static Batch Set(float f) { return {f}; }
+  static Batch Gather(const float *base, const uint32_t *idx) {
+    return {base[idx[0]]};
+  }
+  static Batch LaneMask(uint32_t lanes) { return {lanes > 0 ? 1.f : 0.f}; }
+  void Store(float *dst) const { *dst = v; }
+  float Sum() const { return v; }
+};
+
+inline Batch operator+(Batch a, Batch b) { return {a.v + b.v}; }
+inline Batch operator-(Batch a, Batch b) { return {a.v - b.v}; }
+inline Batch operator*(Batch a, Batch b) { return {a.v * b.v}; }
+inline Batch operator/(Batch a, Batch b) { return {a.v / b.v}; }
+inline Batch Sqrt(Batch a) { return {std::sqrt(a.v)}; }
+inline Batch Round(Batch a) { return {std::nearbyint(a.v)}; }
+inline Batch Min(Batch a, Batch b) { return {std::min(a.v, b.v)}; }
+inline Batch Max(Batch a, Batch b) { return {std::max(a.v, b.v)}; }
+inline Batch Less(Batch a, Batch b) { return {a.v < b.v ? 1.f : 0.f}; }
+inline Batch And(Batch mask, Batch a) { return {mask.v != 0 ? a.v : 0.f}; }
+
+const char *PATH_NAME = "scalar";
+#endif
+
+const uint32_t W = Batch::WIDTH;
+
+// Calls fn(idx, valid, first) for every batch of candidates, `first` is the
+// position of the batch in the candidate list. The tail batch is padded with
+// the first candidate and masked out through `valid`.
+template <typename Fn>
+void ForEachBatch(const uint32_t *indices, uint32_t count, Fn &&fn) {
+  for (uint32_t b = 0; b < count; b += W) {
+    uint32_t lanes = std::min(W, count - b);
+    const uint32_t *idx = indices + b;
+    uint32_t padded[W];
+    if (lanes < W) {
+      for (uint32_t l = 0; l < W; ++l) {
+        padded[l] = l < lanes ? idx[l] : indices[0];
+      }
+      idx = padded;
+    }
+    fn(idx, Batch::LaneMask(lanes), b);
+  }
+}
+
+// Nearest image of a batch of separations, a no-op unless a period is set.
+// Axes without one have a zero inverse and round to no shift.
+struct Periodic {
+  bool enabled;
+  Batch px, py, pz;
+  Batch ix, iy, iz;
+
+  explicit Periodic(const Vector3 &period)
+      : enabled(period != Vector3::Zero), px(Batch::Set(period.x)),
+        py(Batch::Set(period.y)), pz(Batch::Set(period.z)),
+        ix(Batch::Set(period.x > 0 ? 1 / period.x : 0)),
+        iy(Batch::Set(period.y > 0 ? 1 / period.y : 0)),
+        iz(Batch::Set(period.z > 0 ? 1 / period.z : 0)) {}
+
+  void Wrap(Batch &rx, Batch &ry, Batch &rz) const {
+    if (!enabled) {
+      return;
+    }
+    rx = rx - px * Round(rx * ix);
+    ry = ry - py * Round(ry * iy);
+    rz = rz - pz * Round(rz * iz);
+  }
+};
+
+// per-particle masses of the soa, nullptr while they are all Settings::mass
+const float *MassScale(const ParticleSoA &soa) {
+  return soa.massScale.empty() ? nullptr : soa.massScale.data();
+}
+
+} // namespace
+
+template <typename Kernels>
+float SimdDensitySum(const ParticleSoA &soa, const uint32_t *indices,
+                     uint32_t count, const Vector3 &position,
+                     const Vector3 &period, const Kernels &kernels) {
+  Batch px = Batch::Set(position.x);
+  Batch py = Batch::Set(position.y);
+  Batch pz = Batch::Set(position.z);
+  Batch radius2 = Batch::Set(kernels.h * kernels.h);
+  Batch sum = Batch::Set(0);
+  const float *massScale = MassScale(soa);
+  const Periodic periodic(period);
+
+  ForEachBatch(indices, count, [&](const uint32_t *idx, Batch valid,
+                                   uint32_t) {
+    Batch dx = Batch::Gather(soa.x.data(), idx) - px;
+    Batch dy = Batch::Gather(soa.y.data(), idx) - py;
+    Batch dz = Batch::Gather(soa.z.data(), idx) - pz;
+    periodic.Wrap(dx, dy, dz);
+    Batch d2 = dx * dx + dy * dy + dz * dz;
+    Batch mask = And(valid, Less(d2, radius2));
+    Batch w = kernels.density.W2(d2);
+    if (massScale) {
+      w = w * Batch::Gather(massScale, idx);
+    }
+    sum = sum + And(mask, w);
+  });
+
+  return sum.Sum();
+}
+
+template <typename Kernels>
+void SimdForceSum(const ParticleSoA &soa, const uint32_t *indices,
+                  uint32_t count, const SphForceParams &params,
+                  const Kernels &kernels, Vector3 &pressureGrad,
+                  Vector3 &viscosity) {
+  Batch px = Batch::Set(params.position.x);
+  Batch py = Batch::Set(params.position.y);
+  Batch pz = Batch::Set(params.position.z);
+  Batch vx = Batch::Set(params.velocity.x);
+  Batch vy = Batch::Set(params.velocity.y);
+  Batch vz = Batch::Set(params.velocity.z);
+  Batch pressure = Batch::Set(params.pressure);
+  Batch h = Batch::Set(kernels.h);
+  Batch zero = Batch::Set(0);
+  Batch one = Batch::Set(1);
+  Batch pressureCoeff = Batch::Set(-params.mass * 0.5f);
+  Batch viscosityCoeff = Batch::Set(params.dynamicViscosity * params.mass);
+  // the coefficients hold the own mass, `ratio` turns it into the neighbour's
+  const float *massScale = MassScale(soa);
+  Batch invMassScale = Batch::Set(1.f / params.massScale);
+  const Periodic periodic(params.period);
+
+  Batch gx = zero, gy = zero, gz = zero;
+  Batch lx = zero, ly = zero, lz = zero;
+
+  ForEachBatch(indices, count, [&](const uint32_t *idx, Batch valid,
+                                   uint32_t) {
+    Batch rx = px - Batch::Gather(soa.x.data(), idx);
+    Batch ry = py - Batch::Gather(soa.y.data(), idx);
+    Batch rz = pz - Batch::Gather(soa.z.data(), idx);
+    periodic.Wrap(rx, ry, rz);
+    Batch d = Sqrt(rx * rx + ry * ry + rz * rz);
+    Batch mask = And(valid, Less(d, h));
+    // normalized direction, zero for coincident particles
+    Batch invD = And(Less(zero, d), one / d);
+    Batch ratio = one;
+    if (massScale) {
+      ratio = Batch::Gather(massScale, idx) * invMassScale;
+    }
+
+    Batch density = Batch::Gather(soa.density.data(), idx);
+
+    Batch pressureScale =
+        And(mask, pressureCoeff *
+                      (pressure + Batch::Gather(soa.pressure.data(), idx)) /
+                      density * kernels.pressure.GradW(d) * invD * ratio);
+    gx = gx + rx * pressureScale;
+    gy = gy + ry * pressureScale;
+    gz = gz + rz * pressureScale;
+
+    Batch viscosityScale = And(
+        mask, viscosityCoeff * kernels.viscosity.LapW(d) / density * ratio);
+    lx = lx + (Batch::Gather(soa.vx.data(), idx) - vx) * viscosityScale;
+    ly = ly + (Batch::Gather(soa.vy.data(), idx) - vy) * viscosityScale;
+    lz = lz + (Batch::Gather(soa.vz.data(), idx) - vz) * viscosityScale;
+  });
+
+  pressureGrad = Vector3(gx.Sum(), gy.Sum(), gz.Sum());
+  viscosity = Vector3(lx.Sum(), ly.Sum(), lz.Sum());
+}
+
+template <typename Kernels>
+void SimdForcePairs(const ParticleSoA &soa, const uint32_t *indices,
+                    uint32_t count, const SphForceParams &params,
+                    const Kernels &kernels, Vector3 &force, float *pairX,
+                    float *pairY, float *pairZ) {
+  Batch px = Batch::Set(params.position.x);
+  Batch py = Batch::Set(params.position.y);
+  Batch pz = Batch::Set(params.position.z);
+  Batch vx = Batch::Set(params.velocity.x);
+  Batch vy = Batch::Set(params.velocity.y);
+  Batch vz = Batch::Set(params.velocity.z);
+  Batch pressure = Batch::Set(params.pressure);
+  Batch density = Batch::Set(params.density);
+  Batch h = Batch::Set(kernels.h);
+  Batch zero = Batch::Set(0);
+  Batch one = Batch::Set(1);
+  Batch pressureCoeff = Batch::Set(-params.mass * 0.5f);
+  Batch viscosityCoeff = Batch::Set(params.dynamicViscosity * params.mass);
+  // the pair term holds the own mass, which is what the candidate feels, the
+  // own side scales it to the candidate's mass
+  const float *massScale = MassScale(soa);
+  Batch invMassScale = Batch::Set(1.f / params.massScale);
+  const Periodic periodic(params.period);
+
+  Batch fx = zero, fy = zero, fz = zero;
+
+  ForEachBatch(indices, count, [&](const uint32_t *idx, Batch valid,
+                                   uint32_t first) {
+    Batch rx = px - Batch::Gather(soa.x.data(), idx);
+    Batch ry = py - Batch::Gather(soa.y.data(), idx);
+    Batch rz = pz - Batch::Gather(soa.z.data(), idx);
+    periodic.Wrap(rx, ry, rz);
+    Batch d = Sqrt(rx * rx + ry * ry + rz * rz);
+    Batch mask = And(valid, Less(d, h));
+    Batch invD = And(Less(zero, d), one / d);
+
+    // shared part of the pair term, each side divides by the other density
+    Batch pressureScale = And(
+        mask, pressureCoeff *
+                  (pressure + Batch::Gather(soa.pressure.data(), idx)) *
+                  kernels.pressure.GradW(d) * invD);
+    Batch viscosityScale =
+        And(mask, viscosityCoeff * kernels.viscosity.LapW(d));
+    Batch ax = rx * pressureScale +
+               (Batch::Gather(soa.vx.data(), idx) - vx) * viscosityScale;
+    Batch ay = ry * pressureScale +
+               (Batch::Gather(soa.vy.data(), idx) - vy) * viscosityScale;
+    Batch az = rz * pressureScale +
+               (Batch::Gather(soa.vz.data(), idx) - vz) * viscosityScale;
+
+    Batch invDensityJ = one / Batch::Gather(soa.density.data(), idx);
+    if (massScale) {
+      invDensityJ = invDensityJ * Batch::Gather(massScale, idx) * invMassScale;
+    }
+    fx = fx + ax * invDensityJ;
+    fy = fy + ay * invDensityJ;
+    fz = fz + az * invDensityJ;
+
+    (zero - ax / density).Store(pairX + first);
+    (zero - ay / density).Store(pairY + first);
+    (zero - az / density).Store(pairZ + first);
+  });
+
+  force = Vector3(fx.Sum(), fy.Sum(), fz.Sum());
+}
+
+#define INSTANTIATE_KERNELS(Kernels)                                           \
+  template float SimdDensitySum(const ParticleSoA &, const uint32_t *,         \
+                                uint32_t, const Vector3 &, const Vector3 &,    \
+                                const Kernels &);                              \
+  template void SimdForceSum(const ParticleSoA &, const uint32_t *, uint32_t,  \
+                             const SphForceParams &, const Kernels &,          \
+                             Vector3 &, Vector3 &);                            \
+  template void SimdForcePairs(const ParticleSoA &, const uint32_t *,          \
+                               uint32_t, const SphForceParams &,               \
+                               const Kernels &, Vector3 &, float *, float *,   \
+                               float *);
+
+INSTANTIATE_KERNELS(kernels::Mueller)
+INSTANTIATE_KERNELS(kernels::Cubic)
+INSTANTIATE_KERNELS(kernels::Wendland)
+#undef INSTANTIATE_KERNELS
+
+uint32_t SimdPadding(uint32_t count) { return (count + W - 1) / W * W; }
+
+const char *SimdPathName() { return PATH_NAME; }
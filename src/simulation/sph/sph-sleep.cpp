@@ -0,0 +1,121 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "sph-internal.h"
+#include "sph.h"
+
+// Cells sleep once none of the 27 cells around them had a moving particle for
+// Settings::sleepSteps steps. m_cellRest counts those steps per cell key,
+// m_cellMoved holds the stamp of the last step a particle of the key moved.
+// Sleeping particles keep their density and pressure for the neighbours that
+// are still awake and skip the density, force and integration passes. A
+// moving neighbour resets the count, which wakes the cell on the next step.
+bool Sph::SleepEnabled() const {
+  return m_settings.sleepSteps > 0 &&
+         m_settings.solver == SphSolver::WeaklyCompressible;
+}
+
+void Sph::MarkAsleep() {
+  const size_t particlesNum = m_soa.Size();
+  if (!SleepEnabled()) {
+    m_asleep.clear();
+    return;
+  }
+
+  if (m_cellRest.size() != m_tableSize) {
+    m_cellRest.assign(m_tableSize, 0);
+    m_cellMoved.assign(m_tableSize, 0);
+  }
+  // stamps restart after a wrap, old ones would wake the cells they mark
+  if (++m_sleepStamp == 0) {
+    std::fill(m_cellMoved.begin(), m_cellMoved.end(), 0);
+    m_sleepStamp = 1;
+  }
+
+  const uint32_t sleepSteps = std::min(m_settings.sleepSteps, 255u);
+  m_asleep.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      m_asleep[i] = m_cellRest[m_soa.hash[i]] >= sleepSteps;
+    }
+  });
+}
+
+void Sph::TrackMotion(size_t i, float previousDensity) {
+  const float velocity = m_settings.sleepVelocity;
+  float change = std::abs(m_soa.density[i] - previousDensity);
+  if (m_soa.Velocity(i).LengthSquared() >= velocity * velocity ||
+      change >= m_settings.sleepDensityChange * previousDensity) {
+    std::atomic_ref<uint8_t>(m_cellMoved[m_soa.hash[i]])
+        .store(m_sleepStamp, std::memory_order_relaxed);
+  }
+}
+
+// the cell sleeps again only after sleepSteps more steps at rest
+void Sph::Wake(size_t i) {
+  std::atomic_ref<uint8_t>(m_cellRest[m_soa.hash[i]])
+      .store(0, std::memory_order_relaxed);
+}
+
+bool Sph::NeighbourhoodMoved(const XMINT3 &cell) const {
+  // while the fluid is in motion the own cell usually decides it
+  if (m_cellMoved[GetHash(cell)] == m_sleepStamp) {
+    return true;
+  }
+  for (int i = -1; i <= 1; i++) {
+    for (int j = -1; j <= 1; j++) {
+      for (int k = -1; k <= 1; k++) {
+        XMINT3 neighbour(cell.x + i, cell.y + j, cell.z + k);
+        if (m_settings.denseCells && !InsideGrid(neighbour)) {
+          continue;
+        }
+        if (m_cellMoved[GetHash(neighbour)] == m_sleepStamp) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void Sph::UpdateRest() {
+  if (!SleepEnabled()) {
+    return;
+  }
+
+  const size_t particlesNum = m_soa.Size();
+  const uint32_t sleepSteps = std::min(m_settings.sleepSteps, 255u);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      // every key is one run of the cell order, its first slot owns the count
+      uint32_t key = m_soa.hash[i];
+      if (i > 0 && m_soa.hash[i - 1] == key) {
+        continue;
+      }
+
+      // colliding cells share the key, each of them is checked once in a row
+      bool moved = false;
+      XMINT3 last(-1, -1, -1);
+      for (size_t c = i; c < particlesNum && m_soa.hash[c] == key && !moved;
+           ++c) {
+        XMINT3 cell = GetCell(m_soa.Position(c));
+        if (m_settings.denseCells) {
+          cell = ClampCell(cell);
+        }
+        if (c > i && cell.x == last.x && cell.y == last.y &&
+            cell.z == last.z) {
+          continue;
+        }
+        last = cell;
+        moved = NeighbourhoodMoved(cell);
+      }
+
+      uint8_t &rest = m_cellRest[key];
+      rest = moved ? 0 : (uint8_t)std::min<uint32_t>(rest + 1, sleepSteps);
+    }
+  });
+}
@@ -1,29 +1,181 @@
 #include "sph.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
-Sph::Sph(const Settings &settings) : m_settings(settings) {
-  poly6 = 315.0f / (64.0f * M_PI * pow(settings.h, 9));
-  spikyGrad = -45.0f / (M_PI * pow(settings.h, 6));
-  spikyLap = 45.0f / (M_PI * pow(settings.h, 6));
-  h2 = settings.h * settings.h;
+#include "sph-internal.h"
+#include "sph-kernels.h"
+#include "sph-simd.h"
+
+namespace {
+// buckets visited by a candidate search, room for the 343 cells of a search
+// radius of up to 3 h
+const uint32_t VISITED_BITS = 10;
+const uint32_t VISITED_SLOTS = 1u << VISITED_BITS;
+const uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+
+// 13 of the 26 neighbour cells, the other half is covered from the other side
+const XMINT3 HALF_SHELL[13] = {
+    {1, 0, 0},  {-1, 1, 0}, {0, 1, 0},  {1, 1, 0},   {-1, -1, 1},
+    {0, -1, 1}, {1, -1, 1}, {-1, 0, 1}, {0, 0, 1},   {1, 0, 1},
+    {-1, 1, 1}, {0, 1, 1},  {1, 1, 1},
+};
+
+// 21 bits per axis, interleaved as ...z1y1x1z0y0x0
+uint64_t SpreadBits(uint32_t v) {
+  uint64_t x = v & 0x1FFFFF;
+  x = (x | x << 32) & 0x1F00000000FFFFull;
+  x = (x | x << 16) & 0x1F0000FF0000FFull;
+  x = (x | x << 8) & 0x100F00F00F00F00Full;
+  x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
 }
 
-UINT Sph::GetHash(XMINT3 cell) {
-  return ((UINT)(cell.x * 92837111) ^ (UINT)(cell.y * 689287499) ^
-          (UINT)(cell.z * 283923481)) %
+// true when two of the keys are equal, the pairs are compared only once two
+// keys set the same bit of a bitmap
+bool HasDuplicate(const uint32_t *keys, size_t count) {
+  uint64_t bitmap[64] = {};
+  bool clash = false;
+  for (size_t k = 0; k < count && !clash; ++k) {
+    uint32_t bit = (keys[k] * 2654435761u) >> 20;
+    clash = bitmap[bit >> 6] & 1ull << (bit & 63);
+    bitmap[bit >> 6] |= 1ull << (bit & 63);
+  }
+  for (size_t j = 0; j < count && clash; ++j) {
+    for (size_t k = j + 1; k < count; ++k) {
+      if (keys[j] == keys[k]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+uint64_t MortonCode(const XMINT3 &cell) {
+  return SpreadBits(cell.x) | SpreadBits(cell.y) << 1 | SpreadBits(cell.z) << 2;
+}
+} // namespace
+
+Sph::Sph(const Settings &settings)
+    : m_settings(settings), m_pool(settings.threadsNum) {
+  // one cell of margin for the particles on the far boundary
+  m_cellsNum =
+      XMINT3((int)std::ceil(m_settings.boundaryLen.x / m_settings.h) + 1,
+             (int)std::ceil(m_settings.boundaryLen.y / m_settings.h) + 1,
+             (int)std::ceil(m_settings.boundaryLen.z / m_settings.h) + 1);
+  // periodic axes are wrapped into whole cells, Init() checks they fit
+  if (m_settings.periodic) {
+    m_period = Vector3(m_settings.boundaryLen.x, 0, m_settings.boundaryLen.z);
+    m_cellsNum.x = (int)std::round(m_period.x / m_settings.h);
+    m_cellsNum.z = (int)std::round(m_period.z / m_settings.h);
+  }
+
+  m_tableSize = m_settings.TABLE_SIZE;
+  if (m_settings.denseCells) {
+    m_tableSize = m_cellsNum.x * m_cellsNum.y * m_cellsNum.z;
+  }
+}
+
+uint32_t Sph::GetHash(XMINT3 cell) const {
+  if (m_settings.periodic) {
+    cell = WrapCell(cell);
+  }
+  if (m_settings.denseCells) {
+    cell = ClampCell(cell);
+    return cell.x + (cell.y + cell.z * m_cellsNum.y) * m_cellsNum.x;
+  }
+  return ((uint32_t)(cell.x * 92837111) ^ (uint32_t)(cell.y * 689287499) ^
+          (uint32_t)(cell.z * 283923481)) %
          m_settings.TABLE_SIZE;
 }
 
-XMINT3 Sph::GetCell(Vector3 position) {
+XMINT3 Sph::ClampCell(const XMINT3 &cell) const {
+  return XMINT3(std::clamp(cell.x, 0, m_cellsNum.x - 1),
+                std::clamp(cell.y, 0, m_cellsNum.y - 1),
+                std::clamp(cell.z, 0, m_cellsNum.z - 1));
+}
+
+XMINT3 Sph::WrapCell(const XMINT3 &cell) const {
+  if (!m_settings.periodic) {
+    return cell;
+  }
+  auto wrap = [](int c, int n) { return (c % n + n) % n; };
+  return XMINT3(wrap(cell.x, m_cellsNum.x), cell.y,
+                wrap(cell.z, m_cellsNum.z));
+}
+
+// Init() makes the periodic axes more than 3 cells wide
+XMINT3 Sph::CellOffset(const XMINT3 &from, const XMINT3 &to) const {
+  XMINT3 d(to.x - from.x, to.y - from.y, to.z - from.z);
+  if (m_settings.periodic) {
+    auto wrap = [](int d, int n) {
+      return d > n / 2 ? d - n : (d < -n / 2 ? d + n : d);
+    };
+    d.x = wrap(d.x, m_cellsNum.x);
+    d.z = wrap(d.z, m_cellsNum.z);
+  }
+  return d;
+}
+
+bool Sph::InsideGrid(const XMINT3 &cell) const {
+  const bool periodic = m_settings.periodic;
+  return (periodic || (cell.x >= 0 && cell.x < m_cellsNum.x)) &&
+         cell.y >= 0 && cell.y < m_cellsNum.y &&
+         (periodic || (cell.z >= 0 && cell.z < m_cellsNum.z));
+}
+
+XMINT3 Sph::GetCell(Vector3 position) const {
   auto res = (position - m_settings.worldOffset) / m_settings.h;
+  if (m_settings.periodic) {
+    return WrapCell(XMINT3((int)std::floor(res.x), (int)res.y,
+                           (int)std::floor(res.z)));
+  }
   return XMINT3(res.x, res.y, res.z);
 }
 
+void Sph::WrapPosition(Vector3 &position) const {
+  if (!m_settings.periodic) {
+    return;
+  }
+  Vector3 localPos = position - m_settings.worldOffset;
+  localPos.x -= m_period.x * std::floor(localPos.x / m_period.x);
+  localPos.z -= m_period.z * std::floor(localPos.z / m_period.z);
+  // rounding can land a tiny negative coordinate on the far side
+  localPos.x = std::min(localPos.x, std::nextafter(m_period.x, 0.f));
+  localPos.z = std::min(localPos.z, std::nextafter(m_period.z, 0.f));
+  position = localPos + m_settings.worldOffset;
+}
+
 void Sph::Init(std::vector<Particle> &particles) {
   const float &h = m_settings.h;
   const XMINT3 &cubeNum = m_settings.initCube;
-  float separation = 0.9f * h;
+  float separation = INIT_SPACING * h;
+
+  if (m_settings.periodic) {
+    // the cells must tile the period and a search, with a cell to spare for
+    // the list margins, must not meet itself around it
+    float search = SupportRadius() + m_settings.neighbourSkin + h;
+    int width = 2 * (int)std::ceil(search / h) + 1;
+    if (std::abs(m_cellsNum.x * h - m_period.x) > 1e-3f * h ||
+        std::abs(m_cellsNum.z * h - m_period.z) > 1e-3f * h ||
+        m_cellsNum.x < width || m_cellsNum.z < width) {
+      throw std::runtime_error("Periodic boundaries need boundaryLen.x and z "
+                               "to be whole multiples of h and cover the "
+                               "neighbour search");
+    }
+  }
+
+  BuildObstacles();
+  BuildKinematics();
+  BuildBoundary();
 
   particles.resize(cubeNum.x * cubeNum.y * cubeNum.z);
 
@@ -45,123 +197,816 @@ void Sph::Init(std::vector<Particle> &particles) {
     }
   }
 
-  std::sort(particles.begin(), particles.end(),
-            [](Particle &a, Particle &b) { return a.hash < b.hash; });
+  m_keys.resize(particles.size());
+  for (size_t i = 0; i < particles.size(); ++i) {
+    m_keys[i] = particles[i].hash;
+  }
+  m_ids.clear();
+  m_massScale.clear();
+  m_sort.Sort(m_keys.data(), m_keys.size(), m_tableSize - 1, m_pool);
+  GatherSorted(particles);
+
+  m_ids.resize(particles.size());
+  std::iota(m_ids.begin(), m_ids.end(), 0);
+  m_stepsSinceReorder = 0;
+  m_stepsSinceResample = 0;
+}
+
+void Sph::Reorder(std::vector<Particle> &particles) {
+  const size_t particlesNum = particles.size();
+  if (m_ids.size() != particlesNum) {
+    m_ids.resize(particlesNum);
+    std::iota(m_ids.begin(), m_ids.end(), 0);
+  }
+
+  // codes of grids up to 1024 cells per axis fit the 32-bit radix sort
+  const uint64_t maxCode = MortonCode(
+      XMINT3(m_cellsNum.x - 1, m_cellsNum.y - 1, m_cellsNum.z - 1));
+  if (maxCode <= std::numeric_limits<uint32_t>::max()) {
+    m_mortonKeys.resize(particlesNum);
+    m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        m_mortonKeys[i] =
+            (uint32_t)MortonCode(ClampCell(GetCell(particles[i].position)));
+      }
+    });
+    m_sort.Sort(m_mortonKeys.data(), particlesNum, (uint32_t)maxCode, m_pool);
+    GatherSorted(particles);
+    return;
+  }
+
+  m_mortonOrder.resize(particlesNum);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      XMINT3 cell = ClampCell(GetCell(particles[i].position));
+      m_mortonOrder[i] = {MortonCode(cell), (uint32_t)i};
+    }
+  });
+  std::sort(m_mortonOrder.begin(), m_mortonOrder.end());
+
+  const bool withMass = m_massScale.size() == particlesNum;
+  m_reordered.resize(particlesNum);
+  m_reorderedIds.resize(particlesNum);
+  m_reorderedMass.resize(withMass ? particlesNum : 0);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      uint32_t from = m_mortonOrder[i].second;
+      m_reordered[i] = particles[from];
+      m_reorderedIds[i] = m_ids[from];
+      if (withMass) {
+        m_reorderedMass[i] = m_massScale[from];
+      }
+    }
+  });
+  particles.swap(m_reordered);
+  m_ids.swap(m_reorderedIds);
+  if (withMass) {
+    m_massScale.swap(m_reorderedMass);
+  }
+}
+
+void Sph::GatherSorted(std::vector<Particle> &particles) {
+  const size_t particlesNum = particles.size();
+  const auto &order = m_sort.Order();
+  const bool withIds = m_ids.size() == particlesNum;
+  const bool withMass = m_massScale.size() == particlesNum;
+  m_reordered.resize(particlesNum);
+  m_reorderedIds.resize(withIds ? particlesNum : 0);
+  m_reorderedMass.resize(withMass ? particlesNum : 0);
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      m_reordered[i] = particles[order[i]];
+      if (withIds) {
+        m_reorderedIds[i] = m_ids[order[i]];
+      }
+      if (withMass) {
+        m_reorderedMass[i] = m_massScale[order[i]];
+      }
+    }
+  });
+  particles.swap(m_reordered);
+  if (withIds) {
+    m_ids.swap(m_reorderedIds);
+  }
+  if (withMass) {
+    m_massScale.swap(m_reorderedMass);
+  }
+}
+
+void Sph::ToIdOrder(const std::vector<Particle> &particles,
+                    std::vector<Particle> &out) {
+  out.resize(particles.size());
+  if (m_ids.size() != particles.size()) {
+    std::copy(particles.begin(), particles.end(), out.begin());
+    return;
+  }
+  m_pool.ParallelFor(0, particles.size(), GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      out[m_ids[i]] = particles[i];
+    }
+  });
+}
+
+// Kernel sum of the lattice Init() places the particles on. With h close to
+// the spacing it is well above Settings::restDensity, so the incompressible
+// solvers use it as the rest state.
+float Sph::LatticeDensity(float support) {
+  const float spacing = INIT_SPACING * m_settings.h;
+  const int reach = (int)std::ceil(support / spacing);
+
+  float density = 0;
+  DispatchKernels(support, [&](const auto &kernels) {
+    for (int x = -reach; x <= reach; ++x) {
+      for (int y = -reach; y <= reach; ++y) {
+        for (int z = -reach; z <= reach; ++z) {
+          float d2 = (x * x + y * y + z * z) * spacing * spacing;
+          if (d2 < support * support) {
+            density += m_settings.mass * kernels.density.W2(d2);
+          }
+        }
+      }
+    }
+  });
+  return density;
+}
+
+float Sph::SupportRadius() const {
+  if (m_settings.solver == SphSolver::WeaklyCompressible) {
+    return m_settings.h;
+  }
+  return m_settings.incompressibleSupport * m_settings.h;
 }
 
 void Sph::Update(float dt, std::vector<Particle> &particles) {
+  m_stats = SphStats();
+  m_time += dt;
+  UpdateKinematics(m_time);
+
+  // the grid refers to the particle order, so it is rebuilt after a reorder,
+  // a resample of the last frame or ParticlesChanged()
+  bool reordered = m_particlesChanged;
+  m_particlesChanged = false;
+  if (m_settings.reorderInterval > 0 &&
+      ++m_stepsSinceReorder >= m_settings.reorderInterval) {
+    Reorder(particles);
+    m_stepsSinceReorder = 0;
+    reordered = true;
+  }
+
+  if (m_settings.solver == SphSolver::PositionBased) {
+    PbfStep(dt, particles);
+    m_stats.substeps = 1;
+    m_stats.dt = dt;
+    return;
+  }
+
+  if (MultiRateEnabled()) {
+    MultiRateStep(dt, particles, reordered);
+    Resample(particles);
+    return;
+  }
+
+  if (!m_settings.adaptiveTimestep) {
+    UpdateForces(particles, reordered);
+    SolvePressure(dt);
+    Integrate(dt, particles);
+    Resample(particles);
+    m_stats.substeps = 1;
+    m_stats.dt = dt;
+    return;
+  }
+
+  m_stats.dt = dt;
+  float remaining = dt;
+  while (remaining > 0) {
+    UpdateForces(particles, reordered && m_stats.substeps == 0);
+
+    // the last substeps share what maxSubsteps leaves, and the frame is split
+    // evenly instead of ending with a sliver
+    uint32_t left = std::max(m_settings.maxSubsteps, m_stats.substeps + 1) -
+                    m_stats.substeps;
+    float limit = std::max(StableTimestep(), remaining / left);
+    float steps = std::ceil(remaining / limit);
+    float step = steps > 1 ? remaining / steps : remaining;
+
+    SolvePressure(step);
+    Integrate(step, particles);
+    remaining = steps > 1 ? remaining - step : 0;
+    m_stats.substeps++;
+    m_stats.dt = std::min(m_stats.dt, step);
+  }
+  Resample(particles);
+}
+
+float Sph::StableTimestep() {
+  const size_t particlesNum = m_soa.Size();
+  const size_t grain = 4 * GRAIN;
+  m_chunkMax.resize(2 * ((particlesNum + grain - 1) / grain));
+
+  m_pool.ParallelFor(0, particlesNum, grain, [&](size_t begin, size_t end) {
+    float velocity2 = 0;
+    float acceleration2 = 0;
+    for (size_t i = begin; i < end; ++i) {
+      Vector3 acceleration =
+          Vector3(m_soa.fx[i], m_soa.fy[i], m_soa.fz[i]) / m_soa.density[i];
+      velocity2 = std::max(velocity2, m_soa.Velocity(i).LengthSquared());
+      acceleration2 = std::max(acceleration2, acceleration.LengthSquared());
+    }
+    m_chunkMax[2 * (begin / grain)] = velocity2;
+    m_chunkMax[2 * (begin / grain) + 1] = acceleration2;
+  });
+
+  float velocity2 = 0;
+  float acceleration2 = 0;
+  for (size_t c = 0; c < m_chunkMax.size(); c += 2) {
+    velocity2 = std::max(velocity2, m_chunkMax[c]);
+    acceleration2 = std::max(acceleration2, m_chunkMax[c + 1]);
+  }
+
   const float &h = m_settings.h;
+  float dt = std::numeric_limits<float>::infinity();
+  if (velocity2 > 0) {
+    dt = m_settings.cflFactor * h / std::sqrt(velocity2);
+  }
+  if (acceleration2 > 0) {
+    dt = std::min(dt, m_settings.forceFactor *
+                          std::sqrt(h / std::sqrt(acceleration2)));
+  }
+  return dt;
+}
 
-  m_hashM.clear();
-
-  // init hash map
-  for (auto &p : particles) {
-    m_hashM.insert(std::make_pair(GetHash(GetCell(p.position)), &p));
-  }
-
-  // Compute density
-  for (auto &p : particles) {
-    p.density = 0;
-    for (int i = -1; i <= 1; i++) {
-      for (int j = -1; j <= 1; j++) {
-        for (int k = -1; k <= 1; k++) {
-          Vector3 localPos = p.position + Vector3(i, j, k) * h;
-          UINT key = GetHash(GetCell(localPos));
-          int count = m_hashM.count(key);
-          auto it = m_hashM.find(key);
-          for (int c = 0; c < count; c++) {
-            float d2 =
-                Vector3::DistanceSquared(p.position, it->second->position);
-            if (d2 < h2) {
-              p.density += m_settings.mass * poly6 * pow(h2 - d2, 3);
-            }
-            it++;
-          }
+void Sph::UpdateForces(std::vector<Particle> &particles, bool reordered) {
+  const size_t particlesNum = particles.size();
+  // the pressure iterations walk the neighbours many times per step
+  const bool useList = m_settings.neighbourSkin > 0 ||
+                       m_settings.solver == SphSolver::Implicit;
+  auto start = Clock::now();
+
+  // the cached lists keep the particle order of their build, so the grid is
+  // only rebuilt together with them
+  bool rebuild = true;
+  if (useList && !reordered && m_grid.Entries().size() == particlesNum) {
+    GatherParticles(particles);
+    rebuild = m_neighbourList.NeedsRebuild(m_soa, m_pool);
+  }
+
+  if (rebuild) {
+    BuildGrid(particles);
+    GatherParticles(particles);
+    if (useList) {
+      m_neighbourList.Build(m_soa, SupportRadius(), m_settings.neighbourSkin,
+                            m_period, ListCandidates(), m_pool);
+    } else {
+      m_neighbourList.Invalidate();
+    }
+  }
+  m_stats.neighbourListBuilds += useList && rebuild ? 1 : 0;
+
+  MarkAsleep();
+  MarkWaiting();
+  m_stats.hashTime += ElapsedMs(start);
+
+  DispatchKernels(SupportRadius(),
+                  [&](const auto &kernels) { Solve(kernels, useList); });
+
+  start = Clock::now();
+  UpdateRest();
+  m_stats.hashTime += ElapsedMs(start);
+}
+
+void Sph::Integrate(float dt, std::vector<Particle> &particles) {
+  const size_t particlesNum = particles.size();
+  const auto &entries = m_grid.Entries();
+  auto start = Clock::now();
+
+  // TimeStep
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      Particle p = m_soa.Get(i);
+      if (Asleep(i)) {
+        p.velocity = Vector3::Zero;
+        if (CollideKinematics(p)) {
+          Wake(i);
+        }
+        particles[entries[i]] = p;
+        continue;
+      }
+      // particles between two level boundaries of the multi-rate stepping
+      // only drift
+      if (!Waiting(i)) {
+        float kick = KickStep(entries[i], dt);
+        p.velocity += kick * p.force / p.density;
+        if (m_settings.obstacleRepulsion > 0) {
+          p.velocity += kick * ObstacleAcceleration(p.position);
+        }
+      }
+      p.position += dt * p.velocity;
+
+      // boundary condition
+      CheckBoundary(p);
+
+      particles[entries[i]] = p;
+    }
+  });
+
+  m_stats.positionsTime += ElapsedMs(start);
+}
+
+template <typename Kernels>
+void Sph::Solve(const Kernels &kernels, bool useList) {
+  auto start = Clock::now();
+
+  // Compute density and pressure
+  ComputeDensity(kernels, useList);
+
+  m_stats.densityTime += ElapsedMs(start);
+  start = Clock::now();
+
+  // Compute pressure force, the half shell only covers a support of h and
+  // would still walk the pairs of sleeping or waiting particles
+  if (m_settings.halfShellForces && SupportRadius() == m_settings.h &&
+      m_asleep.empty() && m_waiting.empty()) {
+    ComputeForcesHalfShell(kernels, useList);
+  } else {
+    ComputeForces(kernels, useList);
+  }
+
+  m_stats.forcesTime += ElapsedMs(start);
+}
+
+template <typename Kernels>
+void Sph::ComputeDensity(const Kernels &kernels, bool useList) {
+  const bool implicit = m_settings.solver == SphSolver::Implicit;
+  if (implicit) {
+    m_iisph.resize(m_soa.Size());
+  }
+  m_pool.ParallelFor(0, m_soa.Size(), GRAIN, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> boundaryCandidates;
+    uint64_t searches = 0;
+    uint64_t candidatesNum = 0;
+    uint64_t falseNum = 0;
+    uint64_t active = 0;
+    for (size_t i = begin; i < end; ++i) {
+      if (Skipped(i)) {
+        continue;
+      }
+      active++;
+      Vector3 position = m_soa.Position(i);
+      auto neighbours = Neighbours(i, useList, candidates);
+      if (m_settings.countFalseCandidates && !useList) {
+        searches++;
+        candidatesNum += neighbours.size();
+        falseNum += CountFalseCandidates(position, SupportRadius(), neighbours);
+      }
+      float sum = SimdDensitySum(m_soa, neighbours.data(), neighbours.size(),
+                                 position, m_period, kernels);
+      if (BoundaryEnabled()) {
+        sum += BoundaryDensity(kernels, i, boundaryCandidates);
+      }
+      float previousDensity = m_soa.density[i];
+      m_soa.density[i] = m_settings.mass * sum;
+      if (!m_asleep.empty()) {
+        TrackMotion(i, previousDensity);
+      }
+
+      // the implicit solver starts from half of the last pressure, the force
+      // pass only adds viscosity and gravity
+      if (implicit) {
+        m_iisph[i].pressure = 0.5f * m_soa.pressure[i];
+        m_soa.pressure[i] = 0;
+        continue;
+      }
+
+      float k = 1;
+      m_soa.pressure[i] = k * (m_soa.density[i] - m_settings.restDensity);
+    }
+
+    std::atomic_ref<uint64_t>(m_stats.activeParticles)
+        .fetch_add(active, std::memory_order_relaxed);
+    if (searches > 0) {
+      CountCandidates(searches, candidatesNum, falseNum);
+    }
+  });
+}
+
+SphForceParams Sph::ForceParams() const {
+  SphForceParams params = {};
+  params.mass = m_settings.mass;
+  params.massScale = 1;
+  params.dynamicViscosity = m_settings.dynamicViscosity;
+  params.period = m_period;
+  return params;
+}
+
+void Sph::SetParticleMass(size_t i, SphForceParams &params) const {
+  if (!m_soa.massScale.empty()) {
+    params.massScale = m_soa.massScale[i];
+    params.mass = m_settings.mass * params.massScale;
+  }
+}
+
+template <typename Kernels>
+void Sph::ComputeForces(const Kernels &kernels, bool useList) {
+  m_pool.ParallelFor(0, m_soa.Size(), GRAIN, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> boundaryCandidates;
+    SphForceParams params = ForceParams();
+
+    for (size_t i = begin; i < end; ++i) {
+      if (Skipped(i)) {
+        continue;
+      }
+      params.position = m_soa.Position(i);
+      params.velocity = m_soa.Velocity(i);
+      params.pressure = m_soa.pressure[i];
+      SetParticleMass(i, params);
+      auto neighbours = Neighbours(i, useList, candidates);
+
+      Vector3 pressureGrad, viscosity;
+      SimdForceSum(m_soa, neighbours.data(), neighbours.size(), params,
+                   kernels, pressureGrad, viscosity);
+      Vector3 force = Vector3(0, -9.8f * m_soa.density[i], 0);
+
+      Vector3 total = pressureGrad + force + viscosity;
+      if (BoundaryEnabled()) {
+        total += BoundaryForce(kernels, i, boundaryCandidates);
+      }
+      m_soa.fx[i] = total.x;
+      m_soa.fy[i] = total.y;
+      m_soa.fz[i] = total.z;
+    }
+  });
+}
+
+// Each pair is evaluated once and both particles get their share. Atomic adds
+// of the partner's share cost more than the pair saves, so the particles are
+// split into one stripe per thread instead: the first stripe adds into m_soa,
+// every other one into a buffer of its own that is summed up afterwards.
+template <typename Kernels>
+void Sph::ComputeForcesHalfShell(const Kernels &kernels, bool useList) {
+  const size_t particlesNum = m_soa.Size();
+  const size_t stripesNum = m_pool.GetThreadsNum();
+  m_stripeForces.resize(stripesNum - 1);
+
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      m_soa.fx[i] = 0;
+      m_soa.fy[i] = -9.8f * m_soa.density[i];
+      m_soa.fz[i] = 0;
+    }
+  });
+
+  m_pool.ParallelFor(0, stripesNum, 1, [&](size_t first, size_t last) {
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> boundaryCandidates;
+    std::vector<float> pairX, pairY, pairZ;
+    SphForceParams params = ForceParams();
+
+    for (size_t stripe = first; stripe < last; ++stripe) {
+      Vector3 *forces = nullptr;
+      if (stripe > 0) {
+        m_stripeForces[stripe - 1].assign(particlesNum, Vector3::Zero);
+        forces = m_stripeForces[stripe - 1].data();
+      }
+      auto add = [&](size_t i, const Vector3 &force) {
+        if (forces) {
+          forces[i] += force;
+        } else {
+          m_soa.fx[i] += force.x;
+          m_soa.fy[i] += force.y;
+          m_soa.fz[i] += force.z;
         }
+      };
+
+      const size_t begin = particlesNum * stripe / stripesNum;
+      const size_t end = particlesNum * (stripe + 1) / stripesNum;
+      for (size_t i = begin; i < end; ++i) {
+        params.position = m_soa.Position(i);
+        params.velocity = m_soa.Velocity(i);
+        params.pressure = m_soa.pressure[i];
+        params.density = m_soa.density[i];
+        SetParticleMass(i, params);
+        HalfShellNeighbours(i, useList, candidates);
+
+        uint32_t count = candidates.size();
+        if (pairX.size() < SimdPadding(count)) {
+          pairX.resize(SimdPadding(count));
+          pairY.resize(SimdPadding(count));
+          pairZ.resize(SimdPadding(count));
+        }
+
+        Vector3 force;
+        SimdForcePairs(m_soa, candidates.data(), count, params, kernels,
+                       force, pairX.data(), pairY.data(), pairZ.data());
+        if (BoundaryEnabled()) {
+          force += BoundaryForce(kernels, i, boundaryCandidates);
+        }
+
+        add(i, force);
+        for (uint32_t c = 0; c < count; ++c) {
+          add(candidates[c], Vector3(pairX[c], pairY[c], pairZ[c]));
+        }
+      }
+    }
+  });
+
+  if (m_stripeForces.empty()) {
+    return;
+  }
+  m_pool.ParallelFor(0, particlesNum, GRAIN, [&](size_t begin, size_t end) {
+    for (const auto &forces : m_stripeForces) {
+      for (size_t i = begin; i < end; ++i) {
+        m_soa.fx[i] += forces[i].x;
+        m_soa.fy[i] += forces[i].y;
+        m_soa.fz[i] += forces[i].z;
       }
     }
+  });
+}
+
+void Sph::HalfShellNeighbours(size_t i, bool useList,
+                              std::vector<uint32_t> &candidates) const {
+  candidates.clear();
+  if (useList) {
+    const uint32_t *list = m_neighbourList.Begin(i);
+    for (uint32_t c = 0; c < m_neighbourList.Count(i); ++c) {
+      if (list[c] > i) {
+        candidates.push_back(list[c]);
+      }
+    }
+    return;
   }
 
-  // Compute pressure
-  for (auto &p : particles) {
-    float k = 1;
-    float p0 = 1000;
-    p.pressure = k * (p.density - p0);
-  }
-
-  // Compute pressure force
-  for (auto &p : particles) {
-    Vector3 pressureGrad = Vector3::Zero;
-    Vector3 force = Vector3(0, -9.8f * p.density, 0);
-    Vector3 viscosity = Vector3::Zero;
-
-    for (int i = -1; i <= 1; i++) {
-      for (int j = -1; j <= 1; j++) {
-        for (int k = -1; k <= 1; k++) {
-          Vector3 localPos = p.position + Vector3(i, j, k) * h;
-          UINT key = GetHash(GetCell(localPos));
-          int count = m_hashM.count(key);
-          auto it = m_hashM.find(key);
-          for (int c = 0; c < count; c++) {
-            float d = Vector3::Distance(p.position, it->second->position);
-            Vector3 dir = (p.position - it->second->position);
-            dir.Normalize();
-            if (d < h) {
-              pressureGrad +=
-                  -dir * m_settings.mass * (p.pressure + it->second->pressure) /
-                  (2 * it->second->density) * spikyGrad * std::pow(h - d, 2);
-              viscosity += m_settings.dynamicViscosity * m_settings.mass *
-                           (it->second->velocity - p.velocity) /
-                           it->second->density * spikyLap * (m_settings.h - d);
-            }
-            it++;
+  XMINT3 cell = GetCell(m_soa.Position(i));
+  uint32_t key = m_soa.hash[i];
+  if (m_settings.denseCells) {
+    // pairs inside the own cell once, by slot order
+    for (uint32_t c = i + 1; c < m_grid.CellEnd(key); ++c) {
+      candidates.push_back(c);
+    }
+    cell = ClampCell(cell);
+    for (const auto &offset : HALF_SHELL) {
+      XMINT3 neighbour(cell.x + offset.x, cell.y + offset.y,
+                       cell.z + offset.z);
+      if (InsideGrid(neighbour)) {
+        AppendCell(m_grid, GetHash(neighbour), candidates);
+      }
+    }
+    return;
+  }
+
+  // Hashed cells can share a key. While the 27 cells around have 27 keys a
+  // bucket holds its own cell and far ones the distance test drops, the half
+  // shell is exact then. Around a collision every key is visited once and the
+  // candidates are sorted by their actual cell, so each pair still comes from
+  // one side only.
+  uint32_t keys[27] = {key};
+  for (size_t k = 0; k < 13; ++k) {
+    const XMINT3 &offset = HALF_SHELL[k];
+    keys[1 + k] = GetHash(
+        XMINT3(cell.x + offset.x, cell.y + offset.y, cell.z + offset.z));
+    keys[14 + k] = GetHash(
+        XMINT3(cell.x - offset.x, cell.y - offset.y, cell.z - offset.z));
+  }
+  if (!HasDuplicate(keys, 27)) {
+    for (uint32_t c = i + 1; c < m_grid.CellEnd(key); ++c) {
+      candidates.push_back(c);
+    }
+    for (size_t k = 1; k < 14; ++k) {
+      AppendCell(m_grid, keys[k], candidates);
+    }
+    return;
+  }
+
+  for (size_t k = 0; k < 14; ++k) {
+    if (std::find(keys, keys + k, keys[k]) == keys + k) {
+      AppendCell(m_grid, keys[k], candidates);
+    }
+  }
+  size_t kept = 0;
+  for (uint32_t c : candidates) {
+    XMINT3 d = CellOffset(cell, GetCell(m_soa.Position(c)));
+    bool halfShell =
+        std::abs(d.x) <= 1 && std::abs(d.y) <= 1 && std::abs(d.z) <= 1 &&
+        (d.z > 0 || (d.z == 0 && (d.y > 0 || (d.y == 0 && d.x > 0))));
+    if (halfShell || (d.x == 0 && d.y == 0 && d.z == 0 && c > i)) {
+      candidates[kept++] = c;
+    }
+  }
+  candidates.resize(kept);
+}
+
+void Sph::BuildGrid(const std::vector<Particle> &particles) {
+  m_keys.resize(particles.size());
+  m_pool.ParallelFor(0, particles.size(), GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      m_keys[i] = GetHash(GetCell(particles[i].position));
+    }
+  });
+  SortKeys();
+}
+
+void Sph::SortKeys() {
+  if (m_settings.gridUpdateFraction > 0 &&
+      m_grid.Update(m_keys, m_tableSize, m_settings.gridUpdateFraction,
+                    m_pool)) {
+    m_stats.gridUpdates++;
+  } else if (m_settings.gridUpdateFraction <= 0) {
+    m_grid.Build(m_keys, m_tableSize, m_pool);
+  }
+}
+
+void Sph::GatherParticles(const std::vector<Particle> &particles) {
+  const auto &entries = m_grid.Entries();
+  const bool withMass = m_massScale.size() == particles.size();
+  m_soa.Resize(particles.size());
+  m_soa.massScale.resize(withMass ? particles.size() : 0);
+  m_pool.ParallelFor(0, particles.size(), GRAIN, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      m_soa.Set(i, particles[entries[i]]);
+      m_soa.hash[i] = m_keys[entries[i]];
+      if (withMass) {
+        m_soa.massScale[i] = m_massScale[entries[i]];
+      }
+    }
+  });
+}
+
+std::span<const uint32_t>
+Sph::Neighbours(size_t i, bool useList,
+                std::vector<uint32_t> &candidates) const {
+  if (useList) {
+    return std::span<const uint32_t>(m_neighbourList.Begin(i),
+                                     m_neighbourList.Count(i));
+  }
+  GatherCandidates(m_soa.Position(i), SupportRadius(), candidates);
+  return candidates;
+}
+
+void Sph::GatherCandidates(const CellGrid &grid, const Vector3 &position,
+                           float radius,
+                           std::vector<uint32_t> &candidates) const {
+  const float &h = m_settings.h;
+  const int reach = (int)std::ceil(radius / h);
+  candidates.clear();
+
+  // particles outside the box share the border cells, so every cell is
+  // visited once
+  if (m_settings.denseCells) {
+    XMINT3 cell = ClampCell(GetCell(position));
+    for (int i = -reach; i <= reach; i++) {
+      for (int j = -reach; j <= reach; j++) {
+        for (int k = -reach; k <= reach; k++) {
+          XMINT3 neighbour(cell.x + i, cell.y + j, cell.z + k);
+          if (InsideGrid(neighbour)) {
+            AppendCell(grid, GetHash(neighbour), candidates);
           }
         }
       }
     }
+    return;
+  }
 
-    p.force = pressureGrad + force + viscosity;
+  // neighbouring cells can collide in the hash table, a small open addressing
+  // set makes sure a bucket is appended only once
+  // around a periodic position whole cells are stepped, a shifted position
+  // could round into the cell past the seam
+  uint32_t visited[VISITED_SLOTS];
+  std::fill(visited, visited + VISITED_SLOTS, EMPTY_SLOT);
+  const XMINT3 cell = GetCell(position);
+  for (int i = -reach; i <= reach; i++) {
+    for (int j = -reach; j <= reach; j++) {
+      for (int k = -reach; k <= reach; k++) {
+        Vector3 localPos = position + Vector3(i, j, k) * h;
+        uint32_t key =
+            m_settings.periodic
+                ? GetHash(XMINT3(cell.x + i, cell.y + j, cell.z + k))
+                : GetHash(GetCell(localPos));
+        uint32_t slot = (key * 2654435761u) >> (32 - VISITED_BITS);
+        while (visited[slot] != EMPTY_SLOT && visited[slot] != key) {
+          slot = (slot + 1) & (VISITED_SLOTS - 1);
+        }
+        if (visited[slot] == key) {
+          continue;
+        }
+        visited[slot] = key;
+        AppendCell(grid, key, candidates);
+      }
+    }
   }
+}
 
-  // TimeStep
-  for (auto &p : particles) {
-    p.velocity += dt * p.force / p.density;
-    p.position += dt * p.velocity;
+// the searches of the neighbour list builds, counted like the ones of the
+// density pass
+NeighbourList::CandidateFn Sph::ListCandidates() {
+  return [this](const Vector3 &position, float radius,
+                std::vector<uint32_t> &out) {
+    GatherCandidates(position, radius, out);
+    if (m_settings.countFalseCandidates) {
+      CountCandidates(1, out.size(),
+                      CountFalseCandidates(position, radius, out));
+    }
+  };
+}
+
+void Sph::AppendCell(const CellGrid &grid, uint32_t key,
+                     std::vector<uint32_t> &candidates) const {
+  uint32_t cellEnd = grid.CellEnd(key);
+  for (uint32_t c = grid.CellBegin(key); c < cellEnd; c++) {
+    candidates.push_back(c);
+  }
+}
 
-    // boundary condition
-    CheckBoundary(p);
+// Candidates of a search of `radius` around position that lie outside the
+// cells it visited, hashed cells sharing a bucket with a visited one
+uint32_t Sph::CountFalseCandidates(const Vector3 &position, float radius,
+                                   std::span<const uint32_t> candidates) const {
+  const int reach = (int)std::ceil(radius / m_settings.h);
+  XMINT3 cell = GetCell(position);
+  if (m_settings.denseCells) {
+    cell = ClampCell(cell);
+  }
+
+  uint32_t count = 0;
+  for (auto c : candidates) {
+    XMINT3 other = GetCell(m_soa.Position(c));
+    if (m_settings.denseCells) {
+      other = ClampCell(other);
+    }
+    XMINT3 d = CellOffset(cell, other);
+    if (std::abs(d.x) > reach || std::abs(d.y) > reach ||
+        std::abs(d.z) > reach) {
+      count++;
+    }
   }
+  return count;
+}
+
+void Sph::CountCandidates(uint64_t searches, uint64_t candidates,
+                          uint64_t falseCandidates) {
+  std::atomic_ref<uint64_t>(m_stats.candidateSearches)
+      .fetch_add(searches, std::memory_order_relaxed);
+  std::atomic_ref<uint64_t>(m_stats.candidates)
+      .fetch_add(candidates, std::memory_order_relaxed);
+  std::atomic_ref<uint64_t>(m_stats.falseCandidates)
+      .fetch_add(falseCandidates, std::memory_order_relaxed);
 }
 
 void Sph::CheckBoundary(Particle &p) {
   const float &h = m_settings.h;
   float dampingCoeff = m_settings.dampingCoeff;
+  // what leaves through a periodic side comes back on the other one
+  WrapPosition(p.position);
   Vector3 localPos = p.position - m_settings.worldOffset;
 
+  // boundary particles push the fluid back, only what passes the walls
+  // is put back on them
+  if (BoundaryEnabled()) {
+    Vector3 clamped = localPos;
+    clamped.Clamp(Vector3::Zero, m_settings.boundaryLen);
+    if (clamped != localPos) {
+      p.velocity = Vector3::Zero;
+    }
+    p.position = clamped + m_settings.worldOffset;
+    CollideObstacles(p);
+    CollideKinematics(p);
+    return;
+  }
+
   if (localPos.y < h) {
     localPos.y = -localPos.y + 2 * h;
     p.velocity.y = -p.velocity.y * dampingCoeff;
   }
 
-  if (localPos.x < h) {
-    localPos.x = -localPos.x + 2 * h;
-    p.velocity.x = -p.velocity.x * dampingCoeff;
+  if (localPos.y > -h + m_settings.boundaryLen.y) {
+    localPos.y = -localPos.y + 2 * (-h + m_settings.boundaryLen.y);
+    p.velocity.y = -p.velocity.y * dampingCoeff;
   }
 
-  if (localPos.x > -h + m_settings.boundaryLen.x) {
-    localPos.x = -localPos.x + 2 * (-h + m_settings.boundaryLen.x);
-    p.velocity.x = -p.velocity.x * dampingCoeff;
-  }
+  if (!m_settings.periodic) {
+    if (localPos.x < h) {
+      localPos.x = -localPos.x + 2 * h;
+      p.velocity.x = -p.velocity.x * dampingCoeff;
+    }
 
-  if (localPos.z < h) {
-    localPos.z = -localPos.z + 2 * h;
-    p.velocity.z = -p.velocity.z * dampingCoeff;
-  }
+    if (localPos.x > -h + m_settings.boundaryLen.x) {
+      localPos.x = -localPos.x + 2 * (-h + m_settings.boundaryLen.x);
+      p.velocity.x = -p.velocity.x * dampingCoeff;
+    }
 
-  if (localPos.z > -h + m_settings.boundaryLen.z) {
-    localPos.z = -localPos.z + 2 * (-h + m_settings.boundaryLen.z);
-    p.velocity.z = -p.velocity.z * dampingCoeff;
+    if (localPos.z < h) {
+      localPos.z = -localPos.z + 2 * h;
+      p.velocity.z = -p.velocity.z * dampingCoeff;
+    }
+
+    if (localPos.z > -h + m_settings.boundaryLen.z) {
+      localPos.z = -localPos.z + 2 * (-h + m_settings.boundaryLen.z);
+      p.velocity.z = -p.velocity.z * dampingCoeff;
+    }
   }
 
   p.position = localPos + m_settings.worldOffset;
+  CollideObstacles(p);
+  CollideKinematics(p);
 }
@@ -0,0 +1,133 @@
+#include "task-pool.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <thread>
+
+TaskPool::TaskPool(uint32_t threadsNum) {
+  if (threadsNum == 0) {
+    threadsNum = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  for (uint32_t i = 0; i < threadsNum; ++i) {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+
+  // worker 0 is the thread calling ParallelFor
+  for (uint32_t i = 1; i < threadsNum; ++i) {
+    m_threads.emplace_back(&TaskPool::WorkerLoop, this, i);
+  }
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &t : m_threads) {
+    t.join();
+  }
+}
+
+void TaskPool::ParallelFor(size_t begin, size_t end, size_t grain,
+                           const Task &task) {
+  if (begin >= end) {
+    return;
+  }
+
+  grain = std::max<size_t>(grain, 1);
+  uint32_t chunksNum = (uint32_t)((end - begin + grain - 1) / grain);
+  if (chunksNum == 1 || m_threads.empty()) {
+    task(begin, end);
+    return;
+  }
+
+  assert(m_remaining == 0);
+  m_task = &task;
+  m_begin = begin;
+  m_end = end;
+  m_grain = grain;
+  m_remaining = chunksNum;
+
+  // hand every worker a contiguous run of chunks, stealing evens out the rest
+  uint32_t workersNum = GetThreadsNum();
+  for (uint32_t w = 0; w < workersNum; ++w) {
+    uint32_t first = (uint64_t)chunksNum * w / workersNum;
+    uint32_t last = (uint64_t)chunksNum * (w + 1) / workersNum;
+    std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+    for (uint32_t c = first; c < last; ++c) {
+      m_queues[w]->chunks.push_back(c);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  RunChunks(0);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this] { return m_remaining == 0; });
+  m_task = nullptr;
+}
+
+void TaskPool::WorkerLoop(uint32_t worker) {
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock,
+                  [&] { return m_stop || m_generation != generation; });
+      if (m_stop) {
+        return;
+      }
+      generation = m_generation;
+    }
+    RunChunks(worker);
+  }
+}
+
+void TaskPool::RunChunks(uint32_t worker) {
+  uint32_t chunk;
+  while (PopChunk(worker, chunk) || StealChunk(worker, chunk)) {
+    size_t begin = m_begin + chunk * m_grain;
+    size_t end = std::min(begin + m_grain, m_end);
+    (*m_task)(begin, end);
+
+    if (m_remaining.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done.notify_all();
+    }
+  }
+}
+
+bool TaskPool::PopChunk(uint32_t worker, uint32_t &chunk) {
+  auto &queue = *m_queues[worker];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.chunks.empty()) {
+    return false;
+  }
+  chunk = queue.chunks.front();
+  queue.chunks.pop_front();
+  return true;
+}
+
+bool TaskPool::StealChunk(uint32_t worker, uint32_t &chunk) {
+  uint32_t workersNum = GetThreadsNum();
+  for (uint32_t i = 1; i < workersNum; ++i) {
+    auto &queue = *m_queues[(worker + i) % workersNum];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.chunks.empty()) {
+      chunk = queue.chunks.back();
+      queue.chunks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,35 @@
+#include "transport.h"
+
+#include <string.h>
+
+#include <numeric>
+#include <stdexcept>
+
+// every rank sends its value to all others, so each one adds up the same
+// numbers in rank order and ends with the same sum
+double Transport::Sum(double value) {
+  const uint32_t rank = GetRank();
+  const uint32_t size = GetSize();
+  std::vector<uint32_t> peers;
+  for (uint32_t r = 0; r < size; ++r) {
+    if (r != rank) {
+      peers.push_back(r);
+    }
+  }
+
+  std::vector<uint8_t> message(sizeof(value));
+  memcpy(message.data(), &value, sizeof(value));
+  std::vector<std::vector<uint8_t>> outgoing(peers.size(), message);
+  std::vector<std::vector<uint8_t>> incoming;
+  Exchange(peers, outgoing, incoming);
+
+  std::vector<double> values(size, 0);
+  values[rank] = value;
+  for (size_t i = 0; i < peers.size(); ++i) {
+    if (incoming[i].size() != sizeof(double)) {
+      throw std::runtime_error("Malformed message in Transport::Sum");
+    }
+    memcpy(&values[peers[i]], incoming[i].data(), sizeof(double));
+  }
+  return std::accumulate(values.begin(), values.end(), 0.0);
+}
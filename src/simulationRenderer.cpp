@@ -241,8 +241,19 @@ void SimRenderer::Update(float dt) {
              sizeof(Vector3) * m_vertex.size());
       pContext->Unmap(m_pMarchingVertexBuffer.Get(), 0);
     } else {
+      // the solver reorders m_particles, the buffer stays in id order
+      const Particle *pData = m_particles.data();
+      if (m_settings.reorderInterval > 0) {
+        m_sphAlgo.ToIdOrder(m_particles, m_uploadParticles);
+        pData = m_uploadParticles.data();
+      }
+      // adaptive resolution only merges below the count of Init(), the
+      // buffer keeps that size and the tail is not drawn
+      m_num_particles = (UINT)m_particles.size();
+      D3D11_BOX box = {0, 0, 0, (UINT)(m_num_particles * sizeof(Particle)),
+                       1, 1};
       pContext->UpdateSubresource(m_sphGpuAlgo.m_pSphDataBuffer.Get(), 0,
-                                  nullptr, m_particles.data(), 0, 0);
+                                  &box, pData, 0, 0);
     }
   } else {
     try {